@@ -0,0 +1,139 @@
+#include "../stream.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// --- A binary tree, walked recursively by the producer ---
+
+struct node {
+    int value;
+    struct node* left;
+    struct node* right;
+};
+
+struct node* tree_insert(struct node* root, int value) {
+    if (root == NULL) {
+        struct node* n = calloc(1, sizeof(struct node));
+        n->value = value;
+        return n;
+    }
+
+    if (value < root->value) {
+        root->left = tree_insert(root->left, value);
+    } else {
+        root->right = tree_insert(root->right, value);
+    }
+
+    return root;
+}
+
+void tree_free(struct node* root) {
+    if (root == NULL) { return; }
+
+    tree_free(root->left);
+    tree_free(root->right);
+    free(root);
+}
+
+/**
+ * @brief In-order traversal written as plain recursion.
+ * No state struct is needed: the call stack is the state.
+ */
+void walk(struct stream_generator* generator, struct node* n) {
+    if (n == NULL) { return; }
+
+    walk(generator, n->left);
+    stream_yield(generator, &n->value);
+    walk(generator, n->right);
+}
+
+void walk_tree(struct stream_generator* generator, void* ctx) {
+    walk(generator, (struct node*) ctx);
+}
+
+// --- A counting producer and the equivalent hand-written source ---
+
+struct range {
+    long current;
+    long end;
+};
+
+void count_up(struct stream_generator* generator, void* ctx) {
+    struct range* r = (struct range*) ctx;
+    for (long i = r->current; i < r->end; i++) {
+        stream_yield(generator, &i);
+    }
+}
+
+void* range_next(void* state) {
+    struct range* r = (struct range*) state;
+    return r->current < r->end ? &r->current : NULL;
+}
+
+void range_increment(void* state) {
+    struct range* r = (struct range*) state;
+    r->current++;
+}
+
+// --- Handlers ---
+
+bool is_odd(void* element) {
+    return (*(int*) element % 2) != 0;
+}
+
+void print_it(void* element) {
+    printf("  -> %d\n", *(int*) element);
+}
+
+double seconds_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// --- Main Example ---
+
+int main() {
+    int values[] = {50, 30, 70, 20, 40, 60, 80, 35, 45, 65};
+    struct node* root = NULL;
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        root = tree_insert(root, values[i]);
+    }
+
+    // 1. Stream a recursive tree walk
+    struct stream_generator generator;
+    stream_generator_init(&generator, walk_tree, root);
+
+    printf("Pipeline: tree walk -> filter(is_odd) -> for_each(print_it)\n");
+    struct stream s = stream_from_generator(&generator);
+    stream_filter(&s, is_odd);
+    stream_for_each(&s, print_it);
+
+    stream_generator_destroy(&generator);
+    tree_free(root);
+
+    // 2. Measure the cost of a yield against a direct next/increment source
+    long n = 10 * 1000 * 1000;
+
+    struct range direct = { .current = 0, .end = n };
+    s = stream_init(&direct, range_next, range_increment);
+    double start = seconds_now();
+    size_t direct_count = stream_count(&s);
+    double direct_time = seconds_now() - start;
+
+    struct range yielded = { .current = 0, .end = n };
+    stream_generator_init(&generator, count_up, &yielded);
+    s = stream_from_generator(&generator);
+    start = seconds_now();
+    size_t yielded_count = stream_count(&s);
+    double yield_time = seconds_now() - start;
+    stream_generator_destroy(&generator);
+
+    printf("\nDirect source: %zu elements, %.2f ns/element\n",
+            direct_count, direct_time * 1e9 / n);
+    printf("Generator:     %zu elements, %.2f ns/element\n",
+            yielded_count, yield_time * 1e9 / n);
+
+    return 0;
+}
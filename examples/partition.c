@@ -0,0 +1,77 @@
+#include "../stream.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// --- Stream Source (Array) ---
+
+struct array_state {
+    int* data;
+    size_t len;
+    size_t idx;
+};
+
+void* array_next(void* state) {
+    struct array_state* s = (struct array_state*) state;
+    if (s->idx >= s->len) {
+        return NULL;
+    }
+    return &s->data[s->idx];
+}
+
+void array_increment(void* state) {
+    struct array_state* s = (struct array_state*) state;
+    s->idx++;
+}
+
+// --- Handlers ---
+
+/**
+ * @brief A 'partition_handler' that buckets by the last digit.
+ * The result is reduced modulo the partition count by the library.
+ */
+size_t last_digit(void* element) {
+    return (size_t) (*(int*) element % 10);
+}
+
+void print_partitions(struct stream_partitions* parts) {
+    for (size_t i = 0; i < parts->count; i++) {
+        int* data = parts->partitions[i].data;
+        printf("  partition %zu:", i);
+        for (size_t j = 0; j < parts->partitions[i].length; j++) {
+            printf(" %d", data[j]);
+        }
+        printf("\n");
+    }
+}
+
+// --- Main Example ---
+
+int main() {
+    int data[] = {11, 22, 33, 44, 55, 66, 77, 88, 99, 10, 21, 32, 43, 54};
+    size_t len = sizeof(data) / sizeof(data[0]);
+
+    // 1. Scatter through write-combining buffers
+    struct array_state source = { .data = data, .len = len, .idx = 0 };
+    struct stream s = stream_init(&source, array_next, array_increment);
+
+    struct stream_partitions parts;
+    printf("Scatter mode, 4 partitions by last digit:\n");
+    if (stream_partition(&s, &parts, 4, sizeof(int), last_digit, STREAM_PARTITION_SCATTER)) {
+        print_partitions(&parts);
+        stream_partitions_destroy(&parts);
+    }
+
+    // 2. Two-pass histogram mode: each partition is sized exactly and all
+    //    of them share one allocation
+    source.idx = 0;
+    s = stream_init_sized(&source, array_next, array_increment, STREAM_SIZED, len);
+
+    printf("\nHistogram mode, 3 partitions by last digit:\n");
+    if (stream_partition(&s, &parts, 3, sizeof(int), last_digit, STREAM_PARTITION_HISTOGRAM)) {
+        print_partitions(&parts);
+        stream_partitions_destroy(&parts);
+    }
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "../stream.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// --- Stream Source (Array) for pull mode ---
+
+struct array_state {
+    int* data;
+    size_t len;
+    size_t idx;
+};
+
+void* array_next(void* state) {
+    struct array_state* s = (struct array_state*) state;
+    if (s->idx >= s->len) {
+        return NULL;
+    }
+    return &s->data[s->idx];
+}
+
+void array_increment(void* state) {
+    struct array_state* s = (struct array_state*) state;
+    s->idx++;
+}
+
+// --- Handlers ---
+
+bool is_even(void* element) {
+    return (*(int*) element % 2) == 0;
+}
+
+void square_it(void* dst, void* src) {
+    int val = *(int*) src;
+    *(int*) dst = val * val;
+}
+
+/**
+ * @brief A push-mode consumer that keeps a running sum and stops
+ * accepting input once the sum passes a threshold.
+ */
+struct sum_ctx {
+    int sum;
+    int threshold;
+};
+
+bool sum_until(void* element, void* ctx) {
+    struct sum_ctx* c = (struct sum_ctx*) ctx;
+    c->sum += *(int*) element;
+    return c->sum < c->threshold;
+}
+
+// --- Main Example ---
+
+int main() {
+    // 1. Push mode: batches arrive as they would from an event loop
+    int batches[3][4] = {
+        {1, 2, 3, 4},
+        {5, 6, 7, 8},
+        {9, 10, 11, 12},
+    };
+
+    struct sum_ctx ctx = { .sum = 0, .threshold = 100 };
+    struct stream s = stream_init_push(sum_until, &ctx);
+    stream_filter(&s, is_even);
+    stream_map(&s, square_it, sizeof(int));
+
+    printf("Push mode: filter(is_even) -> map(square_it) -> sum until >= 100\n");
+    for (int i = 0; i < 3; i++) {
+        size_t taken = stream_push_batch(&s, batches[i], 4, sizeof(int));
+        printf("  batch %d: took %zu elements, running sum %d\n", i, taken, ctx.sum);
+    }
+
+    stream_finish(&s);
+
+    // 2. Pull mode: step the pipeline one output at a time
+    int data[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    struct array_state source = { .data = data, .len = 8, .idx = 0 };
+
+    s = stream_init(&source, array_next, array_increment);
+    stream_filter(&s, is_even);
+    stream_map(&s, square_it, sizeof(int));
+
+    printf("\nPull mode: filter(is_even) -> map(square_it)\n");
+    int* elem;
+    while ((elem = stream_next(&s)) != NULL) {
+        printf("  pulled %d (source index %zu)\n", *elem, source.idx);
+    }
+
+    stream_cleanup(&s);
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "../stream.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// --- Stream Source (a counter that can jump ahead) ---
+
+struct range {
+    long current;
+    long end;
+    long produced;
+};
+
+void* range_next(void* state) {
+    struct range* r = (struct range*) state;
+    if (r->current >= r->end) {
+        return NULL;
+    }
+
+    r->produced++;
+    return &r->current;
+}
+
+void range_increment(void* state) {
+    struct range* r = (struct range*) state;
+    r->current++;
+}
+
+/**
+ * @brief The optional 'advance_handler': skips count elements at once.
+ * With it, elements rejected by stream_sample are never produced.
+ */
+size_t range_advance(void* state, size_t count) {
+    struct range* r = (struct range*) state;
+    size_t left = (size_t) (r->end - r->current);
+    if (count > left) { count = left; }
+
+    r->current += (long) count;
+    return count;
+}
+
+// --- Main Example ---
+
+int main() {
+    long events = 10 * 1000 * 1000;
+
+    // 1. Bernoulli sample of 0.1%, jumping over rejected elements
+    struct range source = { .current = 0, .end = events, .produced = 0 };
+    struct stream s = stream_init(&source, range_next, range_increment);
+    stream_set_advance_handler(&s, range_advance);
+    stream_sample(&s, 0.001);
+
+    size_t sampled = stream_count(&s);
+    printf("Sampled %zu of %ld events; the source produced only %ld\n",
+            sampled, events, source.produced);
+
+    // 2. A uniform sample of exactly 5 events
+    long reservoir[5];
+    source = (struct range) { .current = 0, .end = events, .produced = 0 };
+    s = stream_init(&source, range_next, range_increment);
+
+    size_t k = stream_reservoir(&s, reservoir, 5, sizeof(long));
+    printf("Reservoir of %zu:", k);
+    for (size_t i = 0; i < k; i++) {
+        printf(" %ld", reservoir[i]);
+    }
+    printf("\n");
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include "../stream.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// --- Stream Source (Array) that counts how often it is read ---
+
+struct array_state {
+    int* data;
+    size_t len;
+    size_t idx;
+    size_t reads;
+};
+
+void* array_next(void* state) {
+    struct array_state* s = (struct array_state*) state;
+    if (s->idx >= s->len) {
+        return NULL;
+    }
+
+    s->reads++;
+    return &s->data[s->idx];
+}
+
+void array_increment(void* state) {
+    struct array_state* s = (struct array_state*) state;
+    s->idx++;
+}
+
+// --- Handlers ---
+
+void square_it(void* dst, void* src) {
+    int val = *(int*) src;
+    *(int*) dst = val * val;
+}
+
+void peek_handler(void* element) {
+    (void) element;
+}
+
+bool is_even(void* element) {
+    return (*(int*) element % 2) == 0;
+}
+
+uint64_t hash_int(void* element) {
+    return stream_hash_bytes(element, sizeof(int));
+}
+
+// --- Helpers ---
+
+struct stream sized_stream(struct array_state* source) {
+    source->idx = 0;
+    source->reads = 0;
+    return stream_init_sized(source, array_next, array_increment, STREAM_SIZED, source->len);
+}
+
+void report(const char* pipeline, struct stream* s, struct array_state* source) {
+    bool sized = stream_exact_size(s, NULL);
+    size_t count = stream_count(s);
+    printf("  %-28s SIZED=%-5s count=%-3zu source reads=%zu\n",
+            pipeline, sized ? "true" : "false", count, source->reads);
+}
+
+// --- Main Example ---
+
+int main() {
+    int data[100];
+    for (int i = 0; i < 100; i++) { data[i] = i; }
+
+    struct array_state source = { .data = data, .len = 100 };
+    struct bloom_filter evens;
+    bloom_filter_init(&evens, 1024, 3, hash_int);
+    for (int i = 0; i < 100; i += 2) { bloom_filter_add(&evens, &data[i]); }
+
+    printf("Counting a sized source of 100 elements:\n");
+
+    // map, peek and limit keep the size known: the count needs no reads
+    struct stream s = sized_stream(&source);
+    stream_map(&s, square_it, sizeof(int));
+    stream_peek(&s, peek_handler);
+    report("map -> peek", &s, &source);
+
+    s = sized_stream(&source);
+    stream_limit(&s, 10);
+    report("limit(10)", &s, &source);
+
+    // anything that may drop elements clears SIZED, so the source is walked
+    s = sized_stream(&source);
+    stream_filter(&s, is_even);
+    report("filter(is_even)", &s, &source);
+
+    s = sized_stream(&source);
+    stream_sample(&s, 0.5);
+    report("sample(0.5)", &s, &source);
+
+    s = sized_stream(&source);
+    stream_bloom_filter(&s, &evens);
+    report("bloom_filter(evens)", &s, &source);
+
+    bloom_filter_destroy(&evens);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include "../stream.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// --- Stream Source (a synthetic event feed) ---
+
+struct event_source {
+    uint64_t current;
+    uint64_t end;
+    uint64_t id;
+};
+
+/**
+ * @brief Produces user ids with a skewed distribution: a few ids are very
+ * frequent, most are rare.
+ */
+void* event_next(void* state) {
+    struct event_source* s = (struct event_source*) state;
+    if (s->current >= s->end) {
+        return NULL;
+    }
+
+    uint64_t x = s->current * 0x9e3779b97f4a7c15ULL;
+    s->id = (x >> 40) % 7 == 0 ? (x >> 50) % 10 : (x >> 20) % 50000;
+    return &s->id;
+}
+
+void event_increment(void* state) {
+    struct event_source* s = (struct event_source*) state;
+    s->current++;
+}
+
+// --- Handlers ---
+
+uint64_t hash_id(void* element) {
+    return stream_hash_bytes(element, sizeof(uint64_t));
+}
+
+double id_value(void* element) {
+    return (double) *(uint64_t*) element;
+}
+
+// --- Main Example ---
+
+int main() {
+    uint64_t events = 1000000;
+
+    // 1. Build two HLL sketches over two halves, as two workers would
+    struct hll_sketch first, second;
+    hll_sketch_init(&first, 12, hash_id);
+    hll_sketch_init(&second, 12, hash_id);
+
+    struct event_source source = { .current = 0, .end = events / 2 };
+    struct stream s = stream_init(&source, event_next, event_increment);
+    stream_to_hll(&s, &first);
+
+    source = (struct event_source) { .current = events / 2, .end = events };
+    s = stream_init(&source, event_next, event_increment);
+    stream_to_hll(&s, &second);
+
+    hll_sketch_merge(&first, &second);
+    printf("Distinct ids (HLL, 4 KiB): ~%.0f (exact: 50000)\n", hll_sketch_estimate(&first));
+
+    // 2. Frequencies and quantiles in one pass each
+    struct count_min_sketch frequencies;
+    count_min_sketch_init(&frequencies, 2048, 4, hash_id);
+
+    source = (struct event_source) { .current = 0, .end = events };
+    s = stream_init(&source, event_next, event_increment);
+    stream_to_count_min(&s, &frequencies);
+
+    uint64_t hot = 3, cold = 12345;
+    printf("Frequency of id %llu: ~%llu\n", (unsigned long long) hot,
+            (unsigned long long) count_min_sketch_estimate(&frequencies, &hot));
+    printf("Frequency of id %llu: ~%llu\n", (unsigned long long) cold,
+            (unsigned long long) count_min_sketch_estimate(&frequencies, &cold));
+
+    struct kll_sketch quantiles;
+    kll_sketch_init(&quantiles, 200, id_value);
+
+    source = (struct event_source) { .current = 0, .end = events };
+    s = stream_init(&source, event_next, event_increment);
+    stream_to_kll(&s, &quantiles);
+
+    printf("p50 id: ~%.0f, p99 id: ~%.0f\n",
+            kll_sketch_quantile(&quantiles, 0.5), kll_sketch_quantile(&quantiles, 0.99));
+
+    // 3. Pre-filter a stream with a Bloom filter of "interesting" ids
+    struct bloom_filter interesting;
+    bloom_filter_init(&interesting, 1 << 12, 4, hash_id);
+    for (uint64_t id = 100; id < 200; id++) {
+        bloom_filter_add(&interesting, &id);
+    }
+
+    source = (struct event_source) { .current = 0, .end = events };
+    s = stream_init(&source, event_next, event_increment);
+    stream_bloom_filter(&s, &interesting);
+    printf("Events passing the Bloom filter: %zu\n", stream_count(&s));
+
+    hll_sketch_destroy(&first);
+    hll_sketch_destroy(&second);
+    count_min_sketch_destroy(&frequencies);
+    kll_sketch_destroy(&quantiles);
+    bloom_filter_destroy(&interesting);
+    return 0;
+}
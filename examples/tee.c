@@ -0,0 +1,94 @@
+#include "../stream.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// --- Stream Source (Array) ---
+
+struct array_state {
+    int* data;
+    size_t len;
+    size_t idx;
+};
+
+void* array_next(void* state) {
+    struct array_state* s = (struct array_state*) state;
+    if (s->idx >= s->len) {
+        return NULL;
+    }
+    return &s->data[s->idx];
+}
+
+void array_increment(void* state) {
+    struct array_state* s = (struct array_state*) state;
+    s->idx++;
+}
+
+// --- Handlers ---
+
+bool is_even(void* element) {
+    return (*(int*) element % 2) == 0;
+}
+
+void square_it(void* dst, void* src) {
+    int val = *(int*) src;
+    *(int*) dst = val * val;
+}
+
+void print_visit(void* element) {
+    printf("  source visits %d\n", *(int*) element);
+}
+
+// --- Consumers, one per branch ---
+
+bool count_consumer(void* element, void* ctx) {
+    (void) element;
+    *(size_t*) ctx += 1;
+    return true;
+}
+
+bool sum_consumer(void* element, void* ctx) {
+    *(long*) ctx += *(int*) element;
+    return true;
+}
+
+/**
+ * @brief Short-circuits: once a square above 20 is seen, this branch
+ * detaches while count and sum keep going.
+ */
+bool any_square_above_20(void* element, void* ctx) {
+    if (*(int*) element <= 20) { return true; }
+
+    *(bool*) ctx = true;
+    return false;
+}
+
+// --- Main Example ---
+
+int main() {
+    int data[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    struct array_state source = { .data = data, .len = 8, .idx = 0 };
+
+    struct stream s = stream_init(&source, array_next, array_increment);
+    stream_peek(&s, print_visit);
+
+    size_t count = 0;
+    long sum = 0;
+    bool any_match = false;
+
+    // Each branch is a push stream with its own downstream ops
+    struct stream branches[3];
+    branches[0] = stream_init_push(count_consumer, &count);
+    branches[1] = stream_init_push(sum_consumer, &sum);
+    stream_filter(&branches[1], is_even);
+    branches[2] = stream_init_push(any_square_above_20, &any_match);
+    stream_map(&branches[2], square_it, sizeof(int));
+
+    printf("Pipeline: peek -> tee(count, filter(is_even) -> sum, map(square_it) -> any_match(> 20))\n");
+    stream_tee(&s, branches, 3);
+
+    printf("\ncount = %zu, sum of evens = %ld, any square > 20 = %s\n",
+            count, sum, any_match ? "true" : "false");
+
+    return 0;
+}
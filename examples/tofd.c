@@ -0,0 +1,64 @@
+#include "../stream.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// --- Stream Source (a counter) ---
+
+struct range {
+    long current;
+    long end;
+};
+
+void* range_next(void* state) {
+    struct range* r = (struct range*) state;
+    return r->current < r->end ? &r->current : NULL;
+}
+
+void range_increment(void* state) {
+    struct range* r = (struct range*) state;
+    r->current++;
+}
+
+// --- Handlers ---
+
+bool is_even(void* element) {
+    return (*(long*) element % 2) == 0;
+}
+
+/**
+ * @brief A 'format_handler' that writes one CSV line per element.
+ * snprintf already follows the contract: it returns the length it needs.
+ */
+size_t format_csv(void* element, char* buffer, size_t capacity) {
+    long val = *(long*) element;
+    return (size_t) snprintf(buffer, capacity, "%ld,%ld\n", val, val * val);
+}
+
+// --- Main Example ---
+
+int main() {
+    const char* path = "build/tofd.csv";
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open");
+        return 1;
+    }
+
+    struct range source = { .current = 0, .end = 1000000 };
+    struct stream s = stream_init(&source, range_next, range_increment);
+    stream_filter(&s, is_even);
+
+    printf("Pipeline: filter(is_even) -> to_fd(format_csv)\n");
+    size_t written = stream_to_fd(&s, fd, format_csv);
+
+    if (stream_get_status(&s) != STREAM_OK) {
+        perror("stream_to_fd");
+    }
+
+    close(fd);
+    printf("Wrote %zu bytes to %s\n", written, path);
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include "../stream.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// --- Handlers ---
+
+bool is_multiple_of_three(void* element) {
+    uint64_t val = *(uint64_t*) element;
+    return (val % 3) == 0;
+}
+
+void print_it(void* element) {
+    printf("  -> %llu\n", (unsigned long long) *(uint64_t*) element);
+}
+
+// --- Main Example ---
+
+int main() {
+    // A sorted id list, big enough to span several blocks
+    size_t count = 1000;
+    uint64_t* ids = malloc(count * sizeof(uint64_t));
+    for (size_t i = 0; i < count; i++) {
+        ids[i] = 1000 + i * 7 + (i % 3);
+    }
+
+    // 1. Encode the list once; the array is no longer needed afterwards
+    uint8_t* blob = NULL;
+    size_t length = stream_varint_encode(ids, count, &blob);
+    printf("Encoded %zu ids into %zu bytes (raw: %zu bytes)\n",
+            count, length, count * sizeof(uint64_t));
+
+    // 2. A validated source is sized and can be counted without decoding
+    struct varint_source source;
+    varint_source_init(&source, blob, length);
+
+    if (varint_source_validate(&source)) {
+        struct stream s = stream_from_varint(&source);
+        printf("Count (from headers): %zu\n", stream_count(&s));
+    }
+
+    // 3. Skip ahead by block header, then decode only what is needed
+    varint_source_init(&source, blob, length);
+    if (varint_source_skip_to(&source, 6000)) {
+        printf("Pipeline: skip_to(6000) -> filter(multiple of 3) -> limit(5)\n");
+
+        struct stream s = stream_from_varint(&source);
+        stream_filter(&s, is_multiple_of_three);
+        stream_limit(&s, 5);
+        stream_for_each(&s, print_it);
+    }
+
+    free(blob);
+    free(ids);
+    return 0;
+}
@@ -4,35 +4,39 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-typedef bool (*stream_consumer)(void* element, void* ctx);
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 // Vector functions
 
 struct vector_op vector_op_init(size_t capacity) {
+    struct stream_op* array = malloc(sizeof(struct stream_op) * capacity);
+
     return (struct vector_op) {
         .length = 0,
-        .array = malloc(sizeof(struct stream_op) * capacity),
-        .capacity = capacity,
+        .array = array,
+        .capacity = array ? capacity : 0,
     };
 }
 
-void vector_op_add(struct stream_op op, struct vector_op* vector) {
+bool vector_op_add(struct stream_op op, struct vector_op* vector) {
     if (vector->length >= vector->capacity) {
-        size_t size = vector->capacity * sizeof(struct stream_op);
-        void* array = realloc(vector->array, size * 2);
+        size_t capacity = vector->capacity ? vector->capacity * 2 : 4;
+        void* array = realloc(vector->array, capacity * sizeof(struct stream_op));
 
-        if (array == NULL) {
-            perror("Could not realloc stream_op vector!");
-            abort();
-        }
+        if (array == NULL) { return false; }
 
         vector->array = array;
-        vector->capacity *= 2;
+        vector->capacity = capacity;
     }
 
     vector->array[vector->length] = op;
     vector->length += 1;
+    return true;
 }
 
 void vector_op_destroy(struct vector_op* vector) {
@@ -57,20 +61,95 @@ void stream_cleanup(struct stream* stream) {
     }
 
     free(ops->array);
+    ops->array = NULL;
+    ops->length = 0;
+    ops->capacity = 0;
 }
 
 struct stream stream_init(void* state, next_handler next,
         increment_state_handler increment_state) {
-    return (struct stream) {
+    return stream_init_sized(state, next, increment_state, 0, 0);
+}
+
+// size is only meaningful when STREAM_SIZED is set in characteristics
+struct stream stream_init_sized(void* state, next_handler next,
+        increment_state_handler increment_state,
+        unsigned characteristics, size_t size) {
+    struct stream stream = {
         .state = state,
         .increment_state = increment_state,
         .next = next,
+        .status = STREAM_OK,
+        .characteristics = characteristics,
+        .size = (characteristics & STREAM_SIZED) ? size : 0,
         .ops = vector_op_init(5),
     };
+
+    if (stream.ops.array == NULL) {
+        stream.status = STREAM_ERR_NOMEM;
+    }
+
+    return stream;
+}
+
+// A push stream has no source: elements are fed with stream_push as they
+// arrive and the pipeline is closed with stream_finish
+struct stream stream_init_push(stream_consumer consumer, void* ctx) {
+    struct stream stream = stream_init(NULL, NULL, NULL);
+    stream.sink = consumer;
+    stream.sink_ctx = ctx;
+
+    return stream;
+}
+
+void stream_set_status_handler(struct stream* stream, status_handler handler) {
+    stream->source_status = handler;
+}
+
+void stream_set_advance_handler(struct stream* stream, advance_handler handler) {
+    stream->advance = handler;
+}
+
+int stream_get_status(struct stream* stream) {
+    return atomic_load_explicit(&stream->status, memory_order_relaxed);
+}
+
+// Records status unless an earlier error is already set.
+// Safe to call from any thread, including handlers running in the pipeline.
+void stream_fail(struct stream* stream, int status) {
+    int expected = STREAM_OK;
+    atomic_compare_exchange_strong(&stream->status, &expected, status);
+}
+
+void stream_cancel(struct stream* stream) {
+    stream_fail(stream, STREAM_CANCELLED);
+}
+
+// Checks the source for an error once it has run out of elements
+void _stream_source_ended(struct stream* stream) {
+    if (!stream->source_status) { return; }
+
+    int status = stream->source_status(stream->state);
+    if (status != STREAM_OK) {
+        stream_fail(stream, status);
+    }
+}
+
+// Returns true and stores the number of elements the pipeline will produce
+// if it is known without walking the source, e.g. to pre-size a collection
+bool stream_exact_size(struct stream* stream, size_t* size) {
+    if (!stream || !(stream->characteristics & STREAM_SIZED)) { return false; }
+    if (stream_get_status(stream) != STREAM_OK) { return false; }
+
+    if (size) { *size = stream->size; }
+    return true;
 }
 
 void stream_append_op(struct stream* stream, struct stream_op op) {
-    vector_op_add(op, &stream->ops);
+    if (!vector_op_add(op, &stream->ops)) {
+        stream_op_cleanup(&op);
+        stream_fail(stream, STREAM_ERR_NOMEM);
+    }
 }
 
 // INTERMEDIATE OPERATIONS
@@ -98,7 +177,16 @@ void* stream_map_process(void* curr, void* op_state) {
 void stream_map(struct stream* stream, map_handler handler,
         size_t output_element_size) {
     struct map_state* state = malloc(sizeof(struct map_state));
-    state->output_slot = malloc(output_element_size);
+    void* output_slot = malloc(output_element_size);
+
+    if (state == NULL || output_slot == NULL) {
+        free(state);
+        free(output_slot);
+        stream_fail(stream, STREAM_ERR_NOMEM);
+        return;
+    }
+
+    state->output_slot = output_slot;
     state->mapper = handler;
 
     struct stream_op op = {
@@ -126,6 +214,11 @@ void* stream_filter_process(void* curr, void* op_state) {
 
 void stream_filter(struct stream* stream, filter_handler handler) {
     struct filter_state* state = malloc(sizeof(struct filter_state));
+    if (state == NULL) {
+        stream_fail(stream, STREAM_ERR_NOMEM);
+        return;
+    }
+
     state->filter = handler;
 
     struct stream_op op = {
@@ -134,6 +227,7 @@ void stream_filter(struct stream* stream, filter_handler handler) {
         .cleanup = NULL,
     };
 
+    stream->characteristics &= ~STREAM_SIZED;
     stream_append_op(stream, op);
 }
 
@@ -156,6 +250,11 @@ void* stream_limit_process(void* curr, void* op_state) {
 
 void stream_limit(struct stream* stream, size_t max_length) {
     struct limit_state* state = malloc(sizeof(struct limit_state));
+    if (state == NULL) {
+        stream_fail(stream, STREAM_ERR_NOMEM);
+        return;
+    }
+
     state->length = 0;
     state->max_length = max_length;
 
@@ -165,6 +264,10 @@ void stream_limit(struct stream* stream, size_t max_length) {
         .cleanup = NULL,
     };
 
+    if (stream->size > max_length) {
+        stream->size = max_length;
+    }
+
     stream_append_op(stream, op);
 }
 
@@ -182,6 +285,11 @@ void* stream_peek_process(void* curr, void* op_state) {
 
 void stream_peek(struct stream* stream, void (*peek_handler)(void* element)) {
     struct peek_state* state = malloc(sizeof(struct peek_state));
+    if (state == NULL) {
+        stream_fail(stream, STREAM_ERR_NOMEM);
+        return;
+    }
+
     state->peek_handler = peek_handler;
 
     struct stream_op op = {
@@ -193,6 +301,142 @@ void stream_peek(struct stream* stream, void (*peek_handler)(void* element)) {
     stream_append_op(stream, op);
 }
 
+// sample functions
+
+// splitmix64, seeded per stream so concurrent samplers do not correlate
+_Atomic uint64_t _random_seed_counter = 0;
+
+uint64_t _random_next(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+uint64_t _random_seed() {
+    uint64_t state = (uint64_t) time(NULL) ^ atomic_fetch_add(&_random_seed_counter, 1);
+    return _random_next(&state);
+}
+
+// Uniform in (0, 1], so its log is always finite
+double _random_unit(uint64_t* state) {
+    return ((_random_next(state) >> 11) + 1) * 0x1.0p-53;
+}
+
+struct sample_state {
+    uint64_t rng;
+    double log_reject;
+    size_t skip;
+
+    // source wrapping, when sampling happens before any other op
+    void* state;
+    next_handler next;
+    increment_state_handler increment_state;
+    status_handler source_status;
+    advance_handler advance;
+};
+
+// Number of elements rejected before the next accepted one: a geometric
+// draw replaces one Bernoulli draw per element
+size_t _sample_skip(struct sample_state* state) {
+    if (state->log_reject == 0) { return 0; }
+    if (state->log_reject == -INFINITY) { return SIZE_MAX; }
+
+    double skip = floor(log(_random_unit(&state->rng)) / state->log_reject);
+    return skip >= (double) SIZE_MAX ? SIZE_MAX : (size_t) skip;
+}
+
+void* stream_sample_process(void* curr, void* op_state) {
+    struct sample_state* state = (struct sample_state*) op_state;
+    if (state->skip > 0) {
+        state->skip -= 1;
+        return NULL;
+    }
+
+    state->skip = _sample_skip(state);
+    return curr;
+}
+
+void* stream_sample_source_process(void* curr, void* op_state) {
+    (void) op_state;
+    return curr;
+}
+
+void* _sample_source_next(void* op_state) {
+    struct sample_state* state = (struct sample_state*) op_state;
+
+    if (state->skip > 0) {
+        if (state->advance) {
+            state->advance(state->state, state->skip);
+        } else {
+            for (size_t i = 0; i < state->skip && state->next(state->state); i++) {
+                state->increment_state(state->state);
+            }
+        }
+
+        state->skip = 0;
+    }
+
+    return state->next(state->state);
+}
+
+void _sample_source_increment(void* op_state) {
+    struct sample_state* state = (struct sample_state*) op_state;
+
+    state->increment_state(state->state);
+    state->skip = _sample_skip(state);
+}
+
+int _sample_source_status(void* op_state) {
+    struct sample_state* state = (struct sample_state*) op_state;
+    return state->source_status ? state->source_status(state->state) : STREAM_OK;
+}
+
+// Keeps each element with the given probability. As the first op it wraps
+// the source, so rejected elements are never produced, and jumps over them
+// with the source's advance handler when there is one.
+void stream_sample(struct stream* stream, double probability) {
+    struct sample_state* state = malloc(sizeof(struct sample_state));
+    if (state == NULL) {
+        stream_fail(stream, STREAM_ERR_NOMEM);
+        return;
+    }
+
+    *state = (struct sample_state) {
+        .rng = _random_seed(),
+        // written so that a NaN probability samples nothing
+        .log_reject = !(probability > 0) ? -INFINITY
+            : probability >= 1 ? 0 : log1p(-probability),
+    };
+    state->skip = _sample_skip(state);
+
+    struct stream_op op = {
+        .op_state = state,
+        .process = stream_sample_process,
+        .cleanup = NULL,
+    };
+
+    if (stream->ops.length == 0 && stream->next) {
+        state->state = stream->state;
+        state->next = stream->next;
+        state->increment_state = stream->increment_state;
+        state->source_status = stream->source_status;
+        state->advance = stream->advance;
+
+        stream->state = state;
+        stream->next = _sample_source_next;
+        stream->increment_state = _sample_source_increment;
+        stream->source_status = _sample_source_status;
+        stream->advance = NULL;
+
+        // the op only ties the wrapper's lifetime to the stream
+        op.process = stream_sample_source_process;
+    }
+
+    stream->characteristics &= ~STREAM_SIZED;
+    stream_append_op(stream, op);
+}
+
 // UTIL FUNCTIONS
 
 void* stream_process_element(void* elem, struct stream* stream) {
@@ -214,6 +458,15 @@ void* stream_process_element(void* elem, struct stream* stream) {
 void stream_consume(struct stream* stream, stream_consumer consumer, void* ctx) {
     if (!stream || !consumer) { return; }
 
+    // push streams have no source to walk
+    if (!stream->next || stream_get_status(stream) != STREAM_OK) {
+        stream_cleanup(stream);
+        return;
+    }
+
+    // errors and cancellation are only looked at once per batch of elements
+    size_t budget = STREAM_CHECK_INTERVAL;
+
     void* elem = stream->next(stream->state);
     while (elem != NULL) {
         void* result = stream_process_element(elem, stream);
@@ -225,15 +478,164 @@ void stream_consume(struct stream* stream, stream_consumer consumer, void* ctx)
             }
         }
 
+        if (--budget == 0) {
+            budget = STREAM_CHECK_INTERVAL;
+            if (stream_get_status(stream) != STREAM_OK) { break; }
+        }
+
         stream->increment_state(stream->state);
         elem = stream->next(stream->state);
     }
 
+    if (elem == NULL) {
+        _stream_source_ended(stream);
+    }
+
+    stream_cleanup(stream);
+}
+
+// Runs one element through the ops and into the consumer.
+// Returns false once the consumer has asked to stop.
+bool _stream_push_unchecked(struct stream* stream, void* element) {
+    void* result = stream_process_element(element, stream);
+    if (result != NULL && !stream->sink(result, stream->sink_ctx)) {
+        stream->stopped = true;
+    }
+
+    return !stream->stopped;
+}
+
+// Entry check shared by stream_push and stream_push_batch
+bool _stream_push_ready(struct stream* stream) {
+    if (!stream || !stream->sink || stream->stopped) { return false; }
+
+    if (stream_get_status(stream) != STREAM_OK) {
+        stream->stopped = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool stream_push(struct stream* stream, void* element) {
+    if (!_stream_push_ready(stream)) { return false; }
+
+    return _stream_push_unchecked(stream, element);
+}
+
+// Pushes count contiguous elements, returning how many were taken.
+// The element that made the consumer stop counts as taken.
+size_t stream_push_batch(struct stream* stream, void* elements, size_t count,
+        size_t element_size) {
+    if (!_stream_push_ready(stream)) { return 0; }
+
+    char* elem = (char*) elements;
+    for (size_t i = 0; i < count; i++) {
+        if (!_stream_push_unchecked(stream, elem + i * element_size)) { return i + 1; }
+    }
+
+    return count;
+}
+
+// Safe to call more than once, e.g. on branches already finished by stream_tee
+void stream_finish(struct stream* stream) {
+    if (!stream || stream->released) { return; }
+
+    stream->stopped = true;
+    stream->released = true;
     stream_cleanup(stream);
 }
 
+// Pulls the next element that makes it through the ops, or NULL at the end.
+// The source is only advanced on the following call, so the element stays
+// valid until then. The stream must be released with stream_cleanup.
+void* stream_next(struct stream* stream) {
+    if (!stream || !stream->next || stream->stopped) { return NULL; }
+
+    if (stream_get_status(stream) != STREAM_OK) {
+        stream->stopped = true;
+        return NULL;
+    }
+
+    if (stream->pull_pending) {
+        stream->increment_state(stream->state);
+        stream->pull_pending = false;
+    }
+
+    void* elem = stream->next(stream->state);
+    while (elem != NULL) {
+        void* result = stream_process_element(elem, stream);
+        if (result != NULL) {
+            stream->pull_pending = true;
+            return result;
+        }
+
+        stream->increment_state(stream->state);
+        elem = stream->next(stream->state);
+    }
+
+    _stream_source_ended(stream);
+    stream->stopped = true;
+    return NULL;
+}
+
 // TERMINAL OPERATIONS
 
+// tee
+
+struct tee_ctx {
+    struct stream* branches;
+    size_t count;
+    size_t active;
+};
+
+bool _tee_consumer(void* element, void* ctx) {
+    struct tee_ctx* c = (struct tee_ctx*) ctx;
+
+    for (size_t i = 0; i < c->count; i++) {
+        struct stream* branch = &c->branches[i];
+        if (branch->stopped) { continue; }
+
+        if (!stream_push(branch, element)) {
+            c->active -= 1;
+        }
+    }
+
+    return c->active > 0;
+}
+
+// Fans every element out to count push streams (see stream_init_push) in a
+// single pass over the source. Each branch keeps its own ops; a branch whose
+// consumer stops is detached while the others keep going. All branches are
+// finished afterwards, and a failure of the source is recorded on each.
+void stream_tee(struct stream* stream, struct stream* branches, size_t count) {
+    struct tee_ctx ctx = {
+        .branches = branches,
+        .count = count,
+        .active = 0,
+    };
+
+    for (size_t i = 0; i < count; i++) {
+        if (!_stream_push_ready(&branches[i])) { continue; }
+        ctx.active += 1;
+    }
+
+    if (ctx.active > 0) {
+        stream_consume(stream, _tee_consumer, &ctx);
+    } else {
+        stream_cleanup(stream);
+    }
+
+    int status = stream_get_status(stream);
+    for (size_t i = 0; i < count; i++) {
+        if (status != STREAM_OK) {
+            stream_fail(&branches[i], status);
+        }
+
+        stream_finish(&branches[i]);
+    }
+}
+
 struct foreach_ctx {
     foreach_handler handler;
 };
@@ -291,7 +693,14 @@ bool _count_consumer(void* element, void* ctx) {
 }
 
 size_t stream_count(struct stream* stream) {
+    // Like Java, a sized pipeline is not traversed at all: map and peek
+    // handlers are not invoked when the count is already known
     size_t count = 0;
+    if (stream_exact_size(stream, &count)) {
+        stream_cleanup(stream);
+        return count;
+    }
+
     stream_consume(stream, _count_consumer, &count);
 
     return count;
@@ -348,3 +757,1693 @@ bool stream_all_match(struct stream* stream, match_predicate predicate) {
     stream_consume(stream, _all_match_consumer, &ctx);
     return ctx.match;
 }
+
+// SOURCES
+
+// varint source
+
+#define VARINT_BLOB_HEADER 8
+#define VARINT_BLOCK_HEADER 16
+
+struct varint_block_header {
+    uint32_t count;
+    uint32_t bytes;
+    uint64_t first;
+};
+
+bool _varint_read_header(const struct varint_source* source, size_t offset,
+        struct varint_block_header* header) {
+    if (offset > source->length || source->length - offset < VARINT_BLOCK_HEADER) {
+        return false;
+    }
+
+    const uint8_t* p = source->data + offset;
+    memcpy(&header->count, p, sizeof(uint32_t));
+    memcpy(&header->bytes, p + 4, sizeof(uint32_t));
+    memcpy(&header->first, p + 8, sizeof(uint64_t));
+
+    return header->count > 0 && header->count <= STREAM_VARINT_BLOCK
+        && header->bytes <= source->length - offset - VARINT_BLOCK_HEADER;
+}
+
+size_t _varint_put(uint8_t* dst, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        dst[n++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+
+    dst[n++] = (uint8_t) value;
+    return n;
+}
+
+// Encodes sorted values into a newly allocated blob stored in *out.
+// Returns the blob length, or 0 if the allocation failed.
+size_t stream_varint_encode(const uint64_t* values, size_t count, uint8_t** out) {
+    size_t blocks = (count + STREAM_VARINT_BLOCK - 1) / STREAM_VARINT_BLOCK;
+    size_t capacity = VARINT_BLOB_HEADER + blocks * VARINT_BLOCK_HEADER + count * 10;
+
+    uint8_t* blob = malloc(capacity);
+    if (blob == NULL) { return 0; }
+
+    uint64_t total = count;
+    memcpy(blob, &total, sizeof(total));
+    size_t offset = VARINT_BLOB_HEADER;
+
+    for (size_t start = 0; start < count; start += STREAM_VARINT_BLOCK) {
+        size_t n = count - start;
+        if (n > STREAM_VARINT_BLOCK) { n = STREAM_VARINT_BLOCK; }
+
+        size_t payload = offset + VARINT_BLOCK_HEADER;
+        size_t end = payload;
+        for (size_t i = 1; i < n; i++) {
+            end += _varint_put(blob + end, values[start + i] - values[start + i - 1]);
+        }
+
+        uint32_t block_count = (uint32_t) n;
+        uint32_t bytes = (uint32_t) (end - payload);
+        memcpy(blob + offset, &block_count, sizeof(block_count));
+        memcpy(blob + offset + 4, &bytes, sizeof(bytes));
+        memcpy(blob + offset + 8, &values[start], sizeof(uint64_t));
+
+        offset = end;
+    }
+
+    *out = blob;
+    return offset;
+}
+
+bool _varint_decode_block(struct varint_source* source) {
+    struct varint_block_header header;
+    if (!_varint_read_header(source, source->offset, &header)) { return false; }
+
+    const uint8_t* p = source->data + source->offset + VARINT_BLOCK_HEADER;
+    const uint8_t* end = p + header.bytes;
+    uint64_t* out = source->block;
+    uint64_t value = header.first;
+
+    size_t n = 0;
+    out[n++] = value;
+
+    while (n < header.count) {
+        // SWAR fast path: dense id lists mostly have single byte deltas,
+        // so test eight bytes at once and decode them without branching
+        if (header.count - n >= 8 && end - p >= 8) {
+            uint64_t word;
+            memcpy(&word, p, sizeof(word));
+
+            if ((word & 0x8080808080808080ULL) == 0) {
+                for (int i = 0; i < 8; i++) {
+                    value += p[i];
+                    out[n++] = value;
+                }
+
+                p += 8;
+                continue;
+            }
+        }
+
+        uint64_t delta = 0;
+        unsigned shift = 0;
+        while (p < end && (*p & 0x80) && shift < 63) {
+            delta |= (uint64_t) (*p & 0x7f) << shift;
+            shift += 7;
+            p++;
+        }
+
+        if (p >= end) { return false; }
+
+        delta |= (uint64_t) *p << shift;
+        p++;
+
+        value += delta;
+        out[n++] = value;
+    }
+
+    source->block_length = header.count;
+    source->index = 0;
+    source->offset += VARINT_BLOCK_HEADER + header.bytes;
+    return true;
+}
+
+void varint_source_init(struct varint_source* source, const uint8_t* data, size_t length) {
+    uint64_t total = 0;
+    if (length >= VARINT_BLOB_HEADER) {
+        memcpy(&total, data, sizeof(total));
+    }
+
+    source->data = data;
+    source->length = length;
+    source->offset = VARINT_BLOB_HEADER;
+    source->remaining = (size_t) total;
+    source->block_length = 0;
+    source->index = 0;
+    source->validated = false;
+}
+
+// Opt-in header-only pass over the whole blob: the declared total is trusted
+// only if the blocks add up to it and end exactly at the end of the blob.
+// Run it before stream_from_varint to get a sized stream (O(1) count).
+bool varint_source_validate(struct varint_source* source) {
+    uint64_t total = 0;
+    if (source->length >= VARINT_BLOB_HEADER) {
+        memcpy(&total, source->data, sizeof(total));
+    }
+
+    uint64_t counted = 0;
+    size_t offset = VARINT_BLOB_HEADER;
+    struct varint_block_header header;
+    while (_varint_read_header(source, offset, &header)) {
+        counted += header.count;
+        offset += VARINT_BLOCK_HEADER + header.bytes;
+    }
+
+    source->validated = source->length >= VARINT_BLOB_HEADER
+        && offset == source->length && counted == total;
+    return source->validated;
+}
+
+void* varint_source_next(void* state) {
+    struct varint_source* source = (struct varint_source*) state;
+
+    if (source->index >= source->block_length) {
+        if (!_varint_decode_block(source)) { return NULL; }
+    }
+
+    return &source->block[source->index];
+}
+
+void varint_source_increment(void* state) {
+    struct varint_source* source = (struct varint_source*) state;
+    source->index += 1;
+
+    if (source->remaining > 0) { source->remaining -= 1; }
+}
+
+void _varint_drop(struct varint_source* source, size_t count) {
+    source->remaining = source->remaining > count ? source->remaining - count : 0;
+}
+
+// Positions the source on the first value >= target. Blocks whose successor
+// still starts below target are passed over by header without decoding.
+// Returns false if no such value exists.
+bool varint_source_skip_to(struct varint_source* source, uint64_t target) {
+    for (;;) {
+        bool in_block = source->index < source->block_length
+            && source->block[source->block_length - 1] >= target;
+
+        if (!in_block) {
+            _varint_drop(source, source->block_length - source->index);
+            source->index = source->block_length;
+
+            struct varint_block_header header;
+            struct varint_block_header following;
+            while (_varint_read_header(source, source->offset, &header)) {
+                size_t next = source->offset + VARINT_BLOCK_HEADER + header.bytes;
+                if (!_varint_read_header(source, next, &following)
+                        || following.first >= target) {
+                    break;
+                }
+
+                _varint_drop(source, header.count);
+                source->offset = next;
+            }
+
+            if (!_varint_decode_block(source)) { return false; }
+        }
+
+        while (source->index < source->block_length
+                && source->block[source->index] < target) {
+            source->index += 1;
+            _varint_drop(source, 1);
+        }
+
+        if (source->index < source->block_length) { return true; }
+    }
+}
+
+// Skips whole blocks by header and only decodes the block it lands in
+size_t varint_source_advance(void* state, size_t count) {
+    struct varint_source* source = (struct varint_source*) state;
+
+    size_t in_block = source->block_length - source->index;
+    if (count <= in_block) {
+        source->index += count;
+        _varint_drop(source, count);
+        return count;
+    }
+
+    size_t skipped = in_block;
+    source->index = source->block_length;
+    _varint_drop(source, in_block);
+
+    struct varint_block_header header;
+    while (skipped < count && _varint_read_header(source, source->offset, &header)) {
+        if (skipped + header.count <= count) {
+            skipped += header.count;
+            _varint_drop(source, header.count);
+            source->offset += VARINT_BLOCK_HEADER + header.bytes;
+            continue;
+        }
+
+        if (!_varint_decode_block(source)) { break; }
+
+        source->index = count - skipped;
+        _varint_drop(source, source->index);
+        skipped = count;
+    }
+
+    return skipped;
+}
+
+// Running out of blocks before the count in the blob header means the
+// blob is truncated or corrupt
+int varint_source_status(void* state) {
+    struct varint_source* source = (struct varint_source*) state;
+    return source->remaining > 0 ? STREAM_ERR_SOURCE : STREAM_OK;
+}
+
+// Elements are uint64_t pointers into the source's decode buffer
+// Only a validated blob is declared sized; otherwise terminals walk it and
+// the status handler reports a truncated blob
+struct stream stream_from_varint(struct varint_source* source) {
+    unsigned characteristics = source->validated ? STREAM_SIZED : 0;
+
+    struct stream stream = stream_init_sized(source, varint_source_next,
+            varint_source_increment, characteristics, source->remaining);
+    stream_set_status_handler(&stream, varint_source_status);
+    stream_set_advance_handler(&stream, varint_source_advance);
+
+    return stream;
+}
+
+// generator source
+
+#if defined(__x86_64__) && defined(__ELF__) && !defined(STREAM_GENERATOR_UCONTEXT)
+#define GENERATOR_ASM_SWITCH
+
+// Saves the callee-saved registers and FP control state on the current stack, stores the stack
+// pointer in *from_sp and resumes the context whose stack pointer is to_sp.
+// This avoids the signal mask syscall that swapcontext does on every switch.
+void _generator_switch(void** from_sp, void* to_sp);
+void _generator_trampoline(void);
+
+__asm__(
+    ".text\n"
+    ".globl _generator_switch\n"
+    ".hidden _generator_switch\n"
+    ".type _generator_switch, @function\n"
+    "_generator_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    // MXCSR and the x87 control word are callee-saved as well
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size _generator_switch, .-_generator_switch\n"
+    // first switch into a new stack lands here with the generator in rbx
+    // and the entry function in r12
+    ".globl _generator_trampoline\n"
+    ".hidden _generator_trampoline\n"
+    ".type _generator_trampoline, @function\n"
+    "_generator_trampoline:\n"
+    "    movq %rbx, %rdi\n"
+    "    callq *%r12\n"
+    "    ud2\n"
+    ".size _generator_trampoline, .-_generator_trampoline\n"
+);
+
+#else
+
+#include <ucontext.h>
+
+struct generator_contexts {
+    ucontext_t caller;
+    ucontext_t generator;
+};
+
+#endif
+
+#define GENERATOR_POOL_SIZE 8
+
+// Stacks are kept per thread and reused, so short-lived generators do not
+// pay for an allocation each
+_Thread_local void* _generator_pool[GENERATOR_POOL_SIZE];
+_Thread_local size_t _generator_pool_length = 0;
+
+// Each stack is mapped with an inaccessible guard page at its low end, so
+// an overflowing producer faults instead of corrupting the heap
+size_t _generator_guard_size() {
+    long page = sysconf(_SC_PAGESIZE);
+    return page > 0 ? (size_t) page : 4096;
+}
+
+// Lowest usable address of a stack returned by _generator_stack_acquire
+char* _generator_stack_base(void* stack) {
+    return (char*) stack + _generator_guard_size();
+}
+
+void* _generator_stack_acquire() {
+    if (_generator_pool_length > 0) {
+        _generator_pool_length -= 1;
+        return _generator_pool[_generator_pool_length];
+    }
+
+    size_t guard = _generator_guard_size();
+    void* stack = mmap(NULL, guard + STREAM_GENERATOR_STACK_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stack == MAP_FAILED) { return NULL; }
+
+    if (mprotect(stack, guard, PROT_NONE) != 0) {
+        munmap(stack, guard + STREAM_GENERATOR_STACK_SIZE);
+        return NULL;
+    }
+
+    return stack;
+}
+
+void _generator_stack_release(void* stack) {
+    if (_generator_pool_length < GENERATOR_POOL_SIZE) {
+        _generator_pool[_generator_pool_length] = stack;
+        _generator_pool_length += 1;
+        return;
+    }
+
+    munmap(stack, _generator_guard_size() + STREAM_GENERATOR_STACK_SIZE);
+}
+
+void _generator_enter(struct stream_generator* generator) {
+#ifndef GENERATOR_ASM_SWITCH
+    struct generator_contexts* c = (struct generator_contexts*) generator->contexts;
+    swapcontext(&c->caller, &c->generator);
+#else
+    _generator_switch(&generator->caller_sp, generator->generator_sp);
+#endif
+}
+
+void _generator_leave(struct stream_generator* generator) {
+#ifndef GENERATOR_ASM_SWITCH
+    struct generator_contexts* c = (struct generator_contexts*) generator->contexts;
+    swapcontext(&c->generator, &c->caller);
+#else
+    _generator_switch(&generator->generator_sp, generator->caller_sp);
+#endif
+}
+
+void _generator_entry(struct stream_generator* generator) {
+    generator->producer(generator, generator->ctx);
+    generator->done = true;
+
+    // a finished generator is never resumed again
+    _generator_leave(generator);
+}
+
+#ifndef GENERATOR_ASM_SWITCH
+// makecontext only passes int arguments, so the pointer is split in two
+void _generator_ucontext_entry(unsigned int high, unsigned int low) {
+    uintptr_t address = ((uintptr_t) high << 16 << 16) | (uintptr_t) low;
+    _generator_entry((struct stream_generator*) address);
+}
+#endif
+
+bool stream_generator_init(struct stream_generator* generator,
+        generator_handler producer, void* ctx) {
+    *generator = (struct stream_generator) {
+        .producer = producer,
+        .ctx = ctx,
+        .stack = _generator_stack_acquire(),
+    };
+
+    if (generator->stack == NULL) { return false; }
+
+#ifdef GENERATOR_ASM_SWITCH
+    // Initial frame as _generator_switch expects it: FP control state, six
+    // saved registers and a return address. The trampoline must start
+    // 16-byte aligned.
+    uintptr_t top = (uintptr_t) _generator_stack_base(generator->stack)
+        + STREAM_GENERATOR_STACK_SIZE;
+    top &= ~(uintptr_t) 15;
+
+    void** frame = (void**) (top - 24) - 7;
+    frame[1] = NULL;                           // r15
+    frame[2] = NULL;                           // r14
+    frame[3] = NULL;                           // r13
+    frame[4] = (void*) _generator_entry;       // r12
+    frame[5] = generator;                      // rbx
+    frame[6] = NULL;                           // rbp
+    frame[7] = (void*) _generator_trampoline;  // return address
+
+    // the producer starts with the creating thread's FP modes
+    uint32_t mxcsr;
+    uint16_t fpu_control;
+    __asm__ volatile ("stmxcsr %0" : "=m" (mxcsr));
+    __asm__ volatile ("fnstcw %0" : "=m" (fpu_control));
+    memcpy((char*) frame, &mxcsr, sizeof(mxcsr));
+    memcpy((char*) frame + 4, &fpu_control, sizeof(fpu_control));
+
+    generator->generator_sp = frame;
+#else
+    struct generator_contexts* c = malloc(sizeof(struct generator_contexts));
+    if (c == NULL) {
+        _generator_stack_release(generator->stack);
+        generator->stack = NULL;
+        return false;
+    }
+
+    getcontext(&c->generator);
+    c->generator.uc_stack.ss_sp = _generator_stack_base(generator->stack);
+    c->generator.uc_stack.ss_size = STREAM_GENERATOR_STACK_SIZE;
+    c->generator.uc_link = NULL;
+
+    uintptr_t address = (uintptr_t) generator;
+    makecontext(&c->generator, (void (*)(void)) _generator_ucontext_entry, 2,
+            (unsigned int) (address >> 16 >> 16), (unsigned int) address);
+
+    generator->contexts = c;
+#endif
+
+    return true;
+}
+
+// Releases the stack. An unfinished producer is abandoned where it last
+// yielded; anything it owns on its stack is not cleaned up.
+void stream_generator_destroy(struct stream_generator* generator) {
+    if (generator->stack) {
+        _generator_stack_release(generator->stack);
+    }
+
+    free(generator->contexts);
+    generator->stack = NULL;
+    generator->contexts = NULL;
+    generator->done = true;
+}
+
+void stream_yield(struct stream_generator* generator, void* element) {
+    generator->current = element;
+    generator->has_current = true;
+
+    _generator_leave(generator);
+}
+
+void* stream_generator_next(void* state) {
+    struct stream_generator* generator = (struct stream_generator*) state;
+
+    if (!generator->has_current && !generator->done) {
+        _generator_enter(generator);
+    }
+
+    return generator->has_current ? generator->current : NULL;
+}
+
+void stream_generator_increment(void* state) {
+    struct stream_generator* generator = (struct stream_generator*) state;
+    generator->has_current = false;
+}
+
+struct stream stream_from_generator(struct stream_generator* generator) {
+    return stream_init(generator, stream_generator_next, stream_generator_increment);
+}
+
+// partition
+
+// Bytes staged per partition before they are copied out, a few cache
+// lines so that scattering into many partitions touches few pages at once
+#define PARTITION_WC_BYTES 256
+
+struct partition_ctx {
+    struct stream_partitions* out;
+    partition_handler key;
+    size_t mask;
+    bool failed;
+
+    // scatter mode
+    char* wc_buffers;
+    size_t* wc_lengths;
+    size_t wc_slots;
+    size_t wc_stride;
+
+    // histogram mode
+    char* staged;
+    size_t* staged_keys;
+    size_t staged_length;
+    size_t staged_capacity;
+};
+
+size_t _partition_index(struct partition_ctx* c, void* element) {
+    size_t hash = c->key(element);
+    return c->mask ? (hash & c->mask) : (hash % c->out->count);
+}
+
+bool _partition_append(struct stream_partition* partition, const void* elements,
+        size_t count, size_t element_size) {
+    if (partition->length + count > partition->capacity) {
+        size_t capacity = partition->capacity ? partition->capacity * 2 : 64;
+        while (capacity < partition->length + count) { capacity *= 2; }
+
+        void* data = realloc(partition->data, capacity * element_size);
+        if (data == NULL) { return false; }
+
+        partition->data = data;
+        partition->capacity = capacity;
+    }
+
+    memcpy((char*) partition->data + partition->length * element_size,
+            elements, count * element_size);
+    partition->length += count;
+    return true;
+}
+
+bool _partition_flush(struct partition_ctx* c, size_t index) {
+    size_t element_size = c->out->element_size;
+    char* buffer = c->wc_buffers + index * c->wc_stride;
+
+    bool ok = _partition_append(&c->out->partitions[index], buffer,
+            c->wc_lengths[index], element_size);
+    c->wc_lengths[index] = 0;
+    return ok;
+}
+
+bool _partition_scatter_consumer(void* element, void* ctx) {
+    struct partition_ctx* c = (struct partition_ctx*) ctx;
+    size_t element_size = c->out->element_size;
+    size_t index = _partition_index(c, element);
+
+    char* slot = c->wc_buffers + index * c->wc_stride + c->wc_lengths[index] * element_size;
+    memcpy(slot, element, element_size);
+    c->wc_lengths[index] += 1;
+
+    if (c->wc_lengths[index] == c->wc_slots && !_partition_flush(c, index)) {
+        c->failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool _partition_stage_consumer(void* element, void* ctx) {
+    struct partition_ctx* c = (struct partition_ctx*) ctx;
+    size_t element_size = c->out->element_size;
+
+    if (c->staged_length >= c->staged_capacity) {
+        size_t capacity = c->staged_capacity ? c->staged_capacity * 2 : 256;
+        char* staged = realloc(c->staged, capacity * element_size);
+        if (staged != NULL) { c->staged = staged; }
+
+        size_t* keys = realloc(c->staged_keys, capacity * sizeof(size_t));
+        if (keys != NULL) { c->staged_keys = keys; }
+
+        if (staged == NULL || keys == NULL) {
+            c->failed = true;
+            return false;
+        }
+
+        c->staged_capacity = capacity;
+    }
+
+    memcpy(c->staged + c->staged_length * element_size, element, element_size);
+    c->staged_keys[c->staged_length] = _partition_index(c, element);
+    c->staged_length += 1;
+    return true;
+}
+
+bool _partition_scatter(struct stream* stream, struct partition_ctx* c) {
+    size_t count = c->out->count;
+    size_t element_size = c->out->element_size;
+
+    c->wc_slots = PARTITION_WC_BYTES / element_size;
+    if (c->wc_slots == 0) { c->wc_slots = 1; }
+
+    // every partition's slice starts on its own cache line
+    c->wc_stride = (c->wc_slots * element_size + 63) & ~(size_t) 63;
+    size_t bytes = count * c->wc_stride;
+
+    c->wc_buffers = aligned_alloc(64, bytes);
+    c->wc_lengths = calloc(count, sizeof(size_t));
+    if (c->wc_buffers == NULL || c->wc_lengths == NULL) {
+        c->failed = true;
+        stream_cleanup(stream);
+    } else {
+        stream_consume(stream, _partition_scatter_consumer, c);
+    }
+
+    for (size_t i = 0; i < count && !c->failed; i++) {
+        if (!_partition_flush(c, i)) { c->failed = true; }
+    }
+
+    free(c->wc_buffers);
+    free(c->wc_lengths);
+    return !c->failed;
+}
+
+bool _partition_histogram(struct stream* stream, struct partition_ctx* c) {
+    size_t count = c->out->count;
+    size_t element_size = c->out->element_size;
+
+    // a sized stream lets the staging area be allocated once
+    size_t size;
+    if (stream_exact_size(stream, &size) && size > 0) {
+        c->staged = malloc(size * element_size);
+        c->staged_keys = malloc(size * sizeof(size_t));
+        c->staged_capacity = (c->staged && c->staged_keys) ? size : 0;
+    }
+
+    stream_consume(stream, _partition_stage_consumer, c);
+
+    if (!c->failed) {
+        c->out->storage = malloc(c->staged_length * element_size + 1);
+        c->failed = c->out->storage == NULL;
+    }
+
+    if (!c->failed) {
+        struct stream_partition* partitions = c->out->partitions;
+        for (size_t i = 0; i < c->staged_length; i++) {
+            partitions[c->staged_keys[i]].capacity += 1;
+        }
+
+        char* base = c->out->storage;
+        for (size_t i = 0; i < count; i++) {
+            partitions[i].data = base;
+            base += partitions[i].capacity * element_size;
+        }
+
+        for (size_t i = 0; i < c->staged_length; i++) {
+            struct stream_partition* partition = &partitions[c->staged_keys[i]];
+            memcpy((char*) partition->data + partition->length * element_size,
+                    c->staged + i * element_size, element_size);
+            partition->length += 1;
+        }
+    }
+
+    free(c->staged);
+    free(c->staged_keys);
+    return !c->failed;
+}
+
+// Scatters elements into count partitions by key(element), reduced modulo
+// count. Elements are copied, element_size bytes each. Returns false if the
+// stream failed, in which case out holds no data. A count or element_size of
+// 0 also returns false and releases the stream, but leaves its status at
+// STREAM_OK since no element was lost to an error.
+bool stream_partition(struct stream* stream, struct stream_partitions* out, size_t count,
+        size_t element_size, partition_handler key, enum stream_partition_mode mode) {
+    *out = (struct stream_partitions) {
+        .count = count,
+        .element_size = element_size,
+    };
+
+    if (count == 0 || element_size == 0) {
+        stream_cleanup(stream);
+        return false;
+    }
+
+    out->partitions = calloc(count, sizeof(struct stream_partition));
+    if (out->partitions == NULL) {
+        stream_fail(stream, STREAM_ERR_NOMEM);
+        stream_cleanup(stream);
+        return false;
+    }
+
+    struct partition_ctx ctx = {
+        .out = out,
+        .key = key,
+        .mask = (count & (count - 1)) == 0 ? count - 1 : 0,
+    };
+
+    bool ok = mode == STREAM_PARTITION_HISTOGRAM
+        ? _partition_histogram(stream, &ctx)
+        : _partition_scatter(stream, &ctx);
+
+    if (!ok) {
+        stream_fail(stream, STREAM_ERR_NOMEM);
+    }
+
+    if (stream_get_status(stream) != STREAM_OK) {
+        stream_partitions_destroy(out);
+        return false;
+    }
+
+    return true;
+}
+
+void stream_partitions_destroy(struct stream_partitions* partitions) {
+    if (partitions->partitions && partitions->storage == NULL) {
+        for (size_t i = 0; i < partitions->count; i++) {
+            free(partitions->partitions[i].data);
+        }
+    }
+
+    free(partitions->partitions);
+    free(partitions->storage);
+    partitions->partitions = NULL;
+    partitions->storage = NULL;
+    partitions->count = 0;
+}
+
+// SKETCHES
+
+// murmur3 finalizer, spreads weak user hashes over all 64 bits
+uint64_t _sketch_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// FNV-1a over the bytes, for use inside a hash_handler
+uint64_t stream_hash_bytes(const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*) data;
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < length; i++) {
+        h ^= bytes[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return _sketch_mix(h);
+}
+
+// hll
+
+bool hll_sketch_init(struct hll_sketch* sketch, unsigned precision, hash_handler hash) {
+    if (precision < 4) { precision = 4; }
+    if (precision > 18) { precision = 18; }
+
+    *sketch = (struct hll_sketch) {
+        .precision = precision,
+        .registers = calloc((size_t) 1 << precision, sizeof(uint8_t)),
+        .hash = hash,
+    };
+
+    return sketch->registers != NULL;
+}
+
+void hll_sketch_add(struct hll_sketch* sketch, void* element) {
+    uint64_t h = _sketch_mix(sketch->hash(element));
+    size_t index = h >> (64 - sketch->precision);
+
+    uint64_t rest = h << sketch->precision;
+    uint8_t rank = rest ? (uint8_t) (__builtin_clzll(rest) + 1)
+        : (uint8_t) (64 - sketch->precision + 1);
+
+    if (rank > sketch->registers[index]) {
+        sketch->registers[index] = rank;
+    }
+}
+
+double hll_sketch_estimate(const struct hll_sketch* sketch) {
+    size_t m = (size_t) 1 << sketch->precision;
+
+    double sum = 0;
+    size_t zeros = 0;
+    for (size_t i = 0; i < m; i++) {
+        sum += ldexp(1.0, -sketch->registers[i]);
+        if (sketch->registers[i] == 0) { zeros += 1; }
+    }
+
+    double alpha = m == 16 ? 0.673 : m == 32 ? 0.697 : m == 64 ? 0.709
+        : 0.7213 / (1.0 + 1.079 / m);
+    double estimate = alpha * m * m / sum;
+
+    // linear counting is more accurate while many registers are empty
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log((double) m / zeros);
+    }
+
+    return estimate;
+}
+
+bool hll_sketch_merge(struct hll_sketch* dst, const struct hll_sketch* src) {
+    if (dst->precision != src->precision) { return false; }
+
+    size_t m = (size_t) 1 << dst->precision;
+    for (size_t i = 0; i < m; i++) {
+        if (src->registers[i] > dst->registers[i]) {
+            dst->registers[i] = src->registers[i];
+        }
+    }
+
+    return true;
+}
+
+void hll_sketch_destroy(struct hll_sketch* sketch) {
+    free(sketch->registers);
+    sketch->registers = NULL;
+}
+
+// count-min
+
+bool count_min_sketch_init(struct count_min_sketch* sketch, size_t width, size_t depth,
+        hash_handler hash) {
+    if (width == 0) { width = 1; }
+    if (depth == 0) { depth = 1; }
+
+    *sketch = (struct count_min_sketch) {
+        .width = width,
+        .depth = depth,
+        .counters = calloc(width * depth, sizeof(uint64_t)),
+        .hash = hash,
+    };
+
+    return sketch->counters != NULL;
+}
+
+// Row i uses h1 + i * h2, so one user hash serves every row
+size_t _count_min_index(const struct count_min_sketch* sketch, uint64_t h, size_t row) {
+    uint64_t h1 = h;
+    uint64_t h2 = (h >> 32) | 1;
+    return row * sketch->width + (size_t) ((h1 + row * h2) % sketch->width);
+}
+
+void count_min_sketch_add(struct count_min_sketch* sketch, void* element, uint64_t count) {
+    uint64_t h = _sketch_mix(sketch->hash(element));
+
+    for (size_t row = 0; row < sketch->depth; row++) {
+        sketch->counters[_count_min_index(sketch, h, row)] += count;
+    }
+}
+
+uint64_t count_min_sketch_estimate(const struct count_min_sketch* sketch, void* element) {
+    uint64_t h = _sketch_mix(sketch->hash(element));
+    uint64_t estimate = UINT64_MAX;
+
+    for (size_t row = 0; row < sketch->depth; row++) {
+        uint64_t c = sketch->counters[_count_min_index(sketch, h, row)];
+        if (c < estimate) { estimate = c; }
+    }
+
+    return estimate;
+}
+
+bool count_min_sketch_merge(struct count_min_sketch* dst, const struct count_min_sketch* src) {
+    if (dst->width != src->width || dst->depth != src->depth) { return false; }
+
+    for (size_t i = 0; i < dst->width * dst->depth; i++) {
+        dst->counters[i] += src->counters[i];
+    }
+
+    return true;
+}
+
+void count_min_sketch_destroy(struct count_min_sketch* sketch) {
+    free(sketch->counters);
+    sketch->counters = NULL;
+}
+
+// kll
+
+int _double_compare(const void* a, const void* b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// Capacities shrink by 2/3 per level below the top one, never under 2.
+// They only change with the number of levels, so they are cached here.
+void _kll_set_levels(struct kll_sketch* sketch, size_t levels) {
+    sketch->levels = levels;
+
+    double capacity = (double) sketch->k;
+    for (size_t level = levels; level-- > 0;) {
+        size_t limit = (size_t) ceil(capacity);
+        sketch->limits[level] = limit < 2 ? 2 : limit;
+        capacity *= 2.0 / 3.0;
+    }
+}
+
+bool _kll_reserve(struct kll_sketch* sketch, size_t level, size_t length) {
+    if (length <= sketch->capacities[level]) { return true; }
+
+    size_t capacity = sketch->capacities[level] ? sketch->capacities[level] : 4;
+    while (capacity < length) { capacity *= 2; }
+
+    double* items = realloc(sketch->items[level], capacity * sizeof(double));
+    if (items == NULL) { return false; }
+
+    sketch->items[level] = items;
+    sketch->capacities[level] = capacity;
+    return true;
+}
+
+bool _kll_append(struct kll_sketch* sketch, size_t level, const double* values, size_t count) {
+    if (!_kll_reserve(sketch, level, sketch->lengths[level] + count)) { return false; }
+
+    memcpy(sketch->items[level] + sketch->lengths[level], values, count * sizeof(double));
+    sketch->lengths[level] += count;
+    return true;
+}
+
+// Halves the lowest full level: it is sorted and every other item, starting
+// at a random offset, is promoted with twice the weight
+bool _kll_compress(struct kll_sketch* sketch) {
+    for (;;) {
+        size_t level = 0;
+        while (level < sketch->levels
+                && sketch->lengths[level] < sketch->limits[level]) {
+            level += 1;
+        }
+
+        if (level == sketch->levels) { return true; }
+
+        if (level + 1 == sketch->levels) {
+            if (sketch->levels == KLL_MAX_LEVELS) { return true; }
+            _kll_set_levels(sketch, sketch->levels + 1);
+        }
+
+        double* items = sketch->items[level];
+        size_t length = sketch->lengths[level];
+        qsort(items, length, sizeof(double), _double_compare);
+
+        // an odd item out stays behind so the total weight is preserved
+        size_t start = length & 1;
+        sketch->rng ^= sketch->rng << 13;
+        sketch->rng ^= sketch->rng >> 7;
+        sketch->rng ^= sketch->rng << 17;
+        size_t offset = sketch->rng & 1;
+
+        size_t promoted = 0;
+        for (size_t i = start + offset; i < length; i += 2) {
+            items[start + promoted] = items[i];
+            promoted += 1;
+        }
+
+        if (!_kll_append(sketch, level + 1, items + start, promoted)) { return false; }
+        sketch->lengths[level] = start;
+    }
+}
+
+bool kll_sketch_init(struct kll_sketch* sketch, size_t k, value_handler value) {
+    *sketch = (struct kll_sketch) {
+        .k = k < 8 ? 8 : k,
+        .value = value,
+        .rng = 0x9e3779b97f4a7c15ULL,
+    };
+
+    _kll_set_levels(sketch, 1);
+    return _kll_reserve(sketch, 0, sketch->k);
+}
+
+bool kll_sketch_add(struct kll_sketch* sketch, double value) {
+    if (!_kll_append(sketch, 0, &value, 1)) { return false; }
+
+    sketch->n += 1;
+
+    // only a full level 0 can start a cascade of compactions
+    if (sketch->lengths[0] < sketch->limits[0]) { return true; }
+    return _kll_compress(sketch);
+}
+
+struct kll_item {
+    double value;
+    uint64_t weight;
+};
+
+int _kll_item_compare(const void* a, const void* b) {
+    return _double_compare(&((const struct kll_item*) a)->value,
+            &((const struct kll_item*) b)->value);
+}
+
+// Returns the value at rank q in [0, 1], or NAN for an empty sketch
+double kll_sketch_quantile(const struct kll_sketch* sketch, double q) {
+    size_t total = 0;
+    for (size_t level = 0; level < sketch->levels; level++) {
+        total += sketch->lengths[level];
+    }
+
+    if (total == 0) { return NAN; }
+
+    struct kll_item* items = malloc(total * sizeof(struct kll_item));
+    if (items == NULL) { return NAN; }
+
+    size_t n = 0;
+    uint64_t weight_sum = 0;
+    for (size_t level = 0; level < sketch->levels; level++) {
+        for (size_t i = 0; i < sketch->lengths[level]; i++) {
+            items[n].value = sketch->items[level][i];
+            items[n].weight = (uint64_t) 1 << level;
+            weight_sum += items[n].weight;
+            n += 1;
+        }
+    }
+
+    qsort(items, n, sizeof(struct kll_item), _kll_item_compare);
+
+    if (q < 0) { q = 0; }
+    if (q > 1) { q = 1; }
+
+    double target = q * (double) weight_sum;
+    uint64_t cumulative = 0;
+    double result = items[n - 1].value;
+    for (size_t i = 0; i < n; i++) {
+        cumulative += items[i].weight;
+        if ((double) cumulative >= target) {
+            result = items[i].value;
+            break;
+        }
+    }
+
+    free(items);
+    return result;
+}
+
+bool kll_sketch_merge(struct kll_sketch* dst, const struct kll_sketch* src) {
+    if (dst->k != src->k) { return false; }
+
+    if (dst->levels < src->levels) {
+        _kll_set_levels(dst, src->levels);
+    }
+
+    for (size_t level = 0; level < src->levels; level++) {
+        if (!_kll_append(dst, level, src->items[level], src->lengths[level])) {
+            return false;
+        }
+    }
+
+    dst->n += src->n;
+    return _kll_compress(dst);
+}
+
+void kll_sketch_destroy(struct kll_sketch* sketch) {
+    for (size_t level = 0; level < KLL_MAX_LEVELS; level++) {
+        free(sketch->items[level]);
+        sketch->items[level] = NULL;
+    }
+}
+
+// bloom
+
+bool bloom_filter_init(struct bloom_filter* filter, size_t bits, unsigned hashes,
+        hash_handler hash) {
+    size_t words = (bits + 63) / 64;
+    if (words == 0) { words = 1; }
+
+    *filter = (struct bloom_filter) {
+        .bits = words * 64,
+        .hashes = hashes ? hashes : 1,
+        .words = calloc(words, sizeof(uint64_t)),
+        .hash = hash,
+    };
+
+    return filter->words != NULL;
+}
+
+void bloom_filter_add(struct bloom_filter* filter, void* element) {
+    uint64_t h = _sketch_mix(filter->hash(element));
+    uint64_t h2 = (h >> 32) | 1;
+
+    for (unsigned i = 0; i < filter->hashes; i++) {
+        size_t bit = (size_t) ((h + i * h2) % filter->bits);
+        filter->words[bit / 64] |= (uint64_t) 1 << (bit % 64);
+    }
+}
+
+bool bloom_filter_contains(const struct bloom_filter* filter, void* element) {
+    uint64_t h = _sketch_mix(filter->hash(element));
+    uint64_t h2 = (h >> 32) | 1;
+
+    for (unsigned i = 0; i < filter->hashes; i++) {
+        size_t bit = (size_t) ((h + i * h2) % filter->bits);
+        if (!(filter->words[bit / 64] & ((uint64_t) 1 << (bit % 64)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool bloom_filter_merge(struct bloom_filter* dst, const struct bloom_filter* src) {
+    if (dst->bits != src->bits || dst->hashes != src->hashes) { return false; }
+
+    for (size_t i = 0; i < dst->bits / 64; i++) {
+        dst->words[i] |= src->words[i];
+    }
+
+    return true;
+}
+
+void bloom_filter_destroy(struct bloom_filter* filter) {
+    free(filter->words);
+    filter->words = NULL;
+}
+
+// sketch terminals
+
+bool _hll_consumer(void* element, void* ctx) {
+    hll_sketch_add((struct hll_sketch*) ctx, element);
+    return true;
+}
+
+void stream_to_hll(struct stream* stream, struct hll_sketch* sketch) {
+    stream_consume(stream, _hll_consumer, sketch);
+}
+
+bool _count_min_consumer(void* element, void* ctx) {
+    count_min_sketch_add((struct count_min_sketch*) ctx, element, 1);
+    return true;
+}
+
+void stream_to_count_min(struct stream* stream, struct count_min_sketch* sketch) {
+    stream_consume(stream, _count_min_consumer, sketch);
+}
+
+struct kll_ctx {
+    struct kll_sketch* sketch;
+    bool failed;
+};
+
+bool _kll_consumer(void* element, void* ctx) {
+    struct kll_ctx* c = (struct kll_ctx*) ctx;
+
+    if (!kll_sketch_add(c->sketch, c->sketch->value(element))) {
+        c->failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+void stream_to_kll(struct stream* stream, struct kll_sketch* sketch) {
+    struct kll_ctx ctx = {
+        .sketch = sketch,
+        .failed = false,
+    };
+
+    stream_consume(stream, _kll_consumer, &ctx);
+
+    if (ctx.failed) {
+        stream_fail(stream, STREAM_ERR_NOMEM);
+    }
+}
+
+bool _bloom_consumer(void* element, void* ctx) {
+    bloom_filter_add((struct bloom_filter*) ctx, element);
+    return true;
+}
+
+void stream_to_bloom(struct stream* stream, struct bloom_filter* filter) {
+    stream_consume(stream, _bloom_consumer, filter);
+}
+
+// bloom filter op
+
+struct bloom_filter_state {
+    struct bloom_filter* filter;
+};
+
+void* stream_bloom_filter_process(void* curr, void* op_state) {
+    struct bloom_filter_state* state = (struct bloom_filter_state*) op_state;
+    return bloom_filter_contains(state->filter, curr) ? curr : NULL;
+}
+
+// Keeps only elements that may be in filter. The filter is borrowed and
+// must outlive the stream.
+void stream_bloom_filter(struct stream* stream, struct bloom_filter* filter) {
+    struct bloom_filter_state* state = malloc(sizeof(struct bloom_filter_state));
+    if (state == NULL) {
+        stream_fail(stream, STREAM_ERR_NOMEM);
+        return;
+    }
+
+    state->filter = filter;
+
+    struct stream_op op = {
+        .op_state = state,
+        .process = stream_bloom_filter_process,
+        .cleanup = NULL,
+    };
+
+    stream->characteristics &= ~STREAM_SIZED;
+    stream_append_op(stream, op);
+}
+
+// to_fd
+
+#ifdef STREAM_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+// Minimal io_uring over raw syscalls, enough for one write in flight
+struct fd_uring {
+    int fd;
+
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+void _uring_destroy(struct fd_uring* uring) {
+    if (uring->sqes) { munmap(uring->sqes, uring->sqes_size); }
+    if (uring->cq_ring && uring->cq_ring != uring->sq_ring) {
+        munmap(uring->cq_ring, uring->cq_ring_size);
+    }
+    if (uring->sq_ring) { munmap(uring->sq_ring, uring->sq_ring_size); }
+    if (uring->fd >= 0) { close(uring->fd); }
+}
+
+bool _uring_init(struct fd_uring* uring) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(uring, 0, sizeof(*uring));
+
+    uring->fd = (int) syscall(__NR_io_uring_setup, 2, &params);
+    if (uring->fd < 0) { return false; }
+
+    // writes at offset -1 (the current position) need IORING_FEAT_RW_CUR_POS
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(uring->fd);
+        uring->fd = -1;
+        return false;
+    }
+
+    uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring->cq_ring_size > uring->sq_ring_size) {
+            uring->sq_ring_size = uring->cq_ring_size;
+        }
+        uring->cq_ring_size = uring->sq_ring_size;
+    }
+
+    uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+    if (uring->sq_ring == MAP_FAILED) {
+        uring->sq_ring = NULL;
+        _uring_destroy(uring);
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        uring->cq_ring = uring->sq_ring;
+    } else {
+        uring->cq_ring = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+        if (uring->cq_ring == MAP_FAILED) {
+            uring->cq_ring = NULL;
+            _uring_destroy(uring);
+            return false;
+        }
+    }
+
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED) {
+        uring->sqes = NULL;
+        _uring_destroy(uring);
+        return false;
+    }
+
+    char* sq = uring->sq_ring;
+    uring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+    uring->sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+    uring->sq_array = (unsigned*) (sq + params.sq_off.array);
+
+    char* cq = uring->cq_ring;
+    uring->cq_head = (unsigned*) (cq + params.cq_off.head);
+    uring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+    uring->cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    return true;
+}
+
+bool _uring_writev(struct fd_uring* uring, int fd, const struct iovec* iov, unsigned count) {
+    unsigned tail = *uring->sq_tail;
+    unsigned index = tail & *uring->sq_mask;
+
+    struct io_uring_sqe* sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t) iov;
+    sqe->len = count;
+    // -1 writes at the current file position, like writev does
+    sqe->off = (uint64_t) -1;
+
+    uring->sq_array[index] = index;
+    __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return syscall(__NR_io_uring_enter, uring->fd, 1, 0, 0, NULL, 0) == 1;
+}
+
+// Waits for the write in flight and returns its result, a byte count or -errno
+long _uring_wait(struct fd_uring* uring) {
+    for (;;) {
+        unsigned head = *uring->cq_head;
+        if (head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+            long res = uring->cqes[head & *uring->cq_mask].res;
+            __atomic_store_n(uring->cq_head, head + 1, __ATOMIC_RELEASE);
+            return res;
+        }
+
+        long ret = syscall(__NR_io_uring_enter, uring->fd, 0, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0 && errno != EINTR) { return -errno; }
+    }
+}
+
+#define FD_BATCHES 2
+#else
+#define FD_BATCHES 1
+#endif
+
+struct fd_batch {
+    char* buffers[STREAM_FD_BUFFERS];
+    size_t lengths[STREAM_FD_BUFFERS];
+    size_t current;
+    struct iovec iov[STREAM_FD_BUFFERS];
+};
+
+struct to_fd_ctx {
+    int fd;
+    format_handler format;
+    bool failed;
+    size_t written;
+
+    struct fd_batch batches[FD_BATCHES];
+    size_t active;
+
+#ifdef STREAM_IO_URING
+    struct fd_uring uring;
+    bool uring_ready;
+    bool in_flight;
+    size_t in_flight_bytes;
+    size_t in_flight_iovs;
+#endif
+};
+
+// Writes every iovec fully, resuming after short writes
+bool _fd_write_all(int fd, struct iovec* iov, size_t count, size_t* written) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, (int) count);
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+
+        *written += (size_t) n;
+        while (count > 0 && (size_t) n >= iov->iov_len) {
+            n -= (ssize_t) iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0) {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= (size_t) n;
+        }
+    }
+
+    return true;
+}
+
+size_t _fd_batch_iov(struct fd_batch* batch) {
+    size_t count = 0;
+    for (size_t i = 0; i <= batch->current && i < STREAM_FD_BUFFERS; i++) {
+        if (batch->lengths[i] == 0) { continue; }
+
+        batch->iov[count].iov_base = batch->buffers[i];
+        batch->iov[count].iov_len = batch->lengths[i];
+        count += 1;
+    }
+
+    return count;
+}
+
+void _fd_batch_reset(struct fd_batch* batch) {
+    memset(batch->lengths, 0, sizeof(batch->lengths));
+    batch->current = 0;
+}
+
+// Completes the write in flight, if any
+bool _to_fd_wait(struct to_fd_ctx* c) {
+#ifdef STREAM_IO_URING
+    if (!c->in_flight) { return true; }
+
+    c->in_flight = false;
+    struct fd_batch* batch = &c->batches[c->active ^ 1];
+    long res = _uring_wait(&c->uring);
+    if (res < 0) {
+        errno = (int) -res;
+        return false;
+    }
+
+    size_t done = (size_t) res;
+    c->written += done;
+
+    // a short write is finished synchronously
+    bool ok = true;
+    if (done < c->in_flight_bytes) {
+        struct iovec* iov = batch->iov;
+        size_t count = c->in_flight_iovs;
+        while (count > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        iov->iov_base = (char*) iov->iov_base + done;
+        iov->iov_len -= done;
+        ok = _fd_write_all(c->fd, iov, count, &c->written);
+    }
+
+    _fd_batch_reset(batch);
+    return ok;
+#else
+    (void) c;
+    return true;
+#endif
+}
+
+// Hands the active batch to the kernel and moves on to the next one
+bool _to_fd_submit(struct to_fd_ctx* c) {
+    struct fd_batch* batch = &c->batches[c->active];
+    size_t count = _fd_batch_iov(batch);
+
+#ifdef STREAM_IO_URING
+    if (c->uring_ready) {
+        if (!_to_fd_wait(c)) { return false; }
+        if (count == 0) { return true; }
+
+        c->in_flight_bytes = 0;
+        for (size_t i = 0; i < count; i++) {
+            c->in_flight_bytes += batch->iov[i].iov_len;
+        }
+        c->in_flight_iovs = count;
+
+        if (!_uring_writev(&c->uring, c->fd, batch->iov, (unsigned) count)) {
+            return false;
+        }
+
+        c->in_flight = true;
+        c->active ^= 1;
+        return true;
+    }
+#endif
+
+    bool ok = _fd_write_all(c->fd, batch->iov, count, &c->written);
+    _fd_batch_reset(batch);
+    return ok;
+}
+
+bool _to_fd_flush(struct to_fd_ctx* c) {
+    return _to_fd_submit(c) && _to_fd_wait(c);
+}
+
+// An element bigger than one buffer is formatted on its own and written
+// directly, after everything queued before it
+bool _to_fd_oversized(struct to_fd_ctx* c, void* element, size_t size) {
+    if (!_to_fd_flush(c)) { return false; }
+
+    char* buffer = malloc(size);
+    if (buffer == NULL) { return false; }
+
+    size_t length = c->format(element, buffer, size);
+    if (length >= size) { length = size - 1; }
+
+    struct iovec iov = { .iov_base = buffer, .iov_len = length };
+    bool ok = _fd_write_all(c->fd, &iov, 1, &c->written);
+
+    free(buffer);
+    return ok;
+}
+
+bool _to_fd_consumer(void* element, void* ctx) {
+    struct to_fd_ctx* c = (struct to_fd_ctx*) ctx;
+
+    for (;;) {
+        struct fd_batch* batch = &c->batches[c->active];
+        size_t used = batch->lengths[batch->current];
+        size_t capacity = STREAM_FD_BUFFER_SIZE - used;
+
+        size_t length = c->format(element, batch->buffers[batch->current] + used, capacity);
+        if (length < capacity) {
+            batch->lengths[batch->current] += length;
+            return true;
+        }
+
+        bool ok;
+        if (length >= STREAM_FD_BUFFER_SIZE) {
+            ok = _to_fd_oversized(c, element, length + 1);
+            if (ok) { return true; }
+        } else if (batch->current + 1 < STREAM_FD_BUFFERS) {
+            batch->current += 1;
+            continue;
+        } else {
+            ok = _to_fd_submit(c);
+        }
+
+        if (!ok) {
+            c->failed = true;
+            return false;
+        }
+    }
+}
+
+// Formats each element into page-aligned buffers and writes them to fd with
+// writev, flushing what is left when the stream ends. Returns the number of
+// bytes written; a write error sets STREAM_ERR_IO and leaves errno as is.
+size_t stream_to_fd(struct stream* stream, int fd, format_handler format) {
+    struct to_fd_ctx ctx = {
+        .fd = fd,
+        .format = format,
+    };
+
+    bool allocated = true;
+    for (size_t b = 0; b < FD_BATCHES; b++) {
+        for (size_t i = 0; i < STREAM_FD_BUFFERS; i++) {
+            ctx.batches[b].buffers[i] = aligned_alloc(4096, STREAM_FD_BUFFER_SIZE);
+            allocated = allocated && ctx.batches[b].buffers[i] != NULL;
+        }
+    }
+
+#ifdef STREAM_IO_URING
+    // without io_uring support in the kernel this falls back to writev
+    ctx.uring_ready = allocated && _uring_init(&ctx.uring);
+#endif
+
+    if (allocated) {
+        stream_consume(stream, _to_fd_consumer, &ctx);
+
+        if (!ctx.failed && !_to_fd_flush(&ctx)) {
+            ctx.failed = true;
+        }
+
+        if (ctx.failed) {
+            // whatever is in flight must land before the buffers are freed
+            int saved_errno = errno;
+            _to_fd_wait(&ctx);
+            errno = saved_errno;
+            stream_fail(stream, STREAM_ERR_IO);
+        }
+    } else {
+        stream_fail(stream, STREAM_ERR_NOMEM);
+        stream_cleanup(stream);
+    }
+
+#ifdef STREAM_IO_URING
+    if (ctx.uring_ready) { _uring_destroy(&ctx.uring); }
+#endif
+
+    for (size_t b = 0; b < FD_BATCHES; b++) {
+        for (size_t i = 0; i < STREAM_FD_BUFFERS; i++) {
+            free(ctx.batches[b].buffers[i]);
+        }
+    }
+
+    return ctx.written;
+}
+
+// reservoir
+
+struct reservoir_ctx {
+    char* out;
+    size_t k;
+    size_t element_size;
+    size_t seen;
+    size_t next;
+    double w;
+    uint64_t rng;
+};
+
+// Algorithm L: the gap to the next replacement is drawn directly, so only
+// a few random numbers are needed per replacement instead of one per element
+void _reservoir_schedule(struct reservoir_ctx* c) {
+    c->w *= exp(log(_random_unit(&c->rng)) / c->k);
+
+    double gap = floor(log(_random_unit(&c->rng)) / log1p(-c->w));
+    c->next = gap >= (double) (SIZE_MAX - c->next) ? SIZE_MAX : c->next + (size_t) gap + 1;
+}
+
+bool _reservoir_consumer(void* element, void* ctx) {
+    struct reservoir_ctx* c = (struct reservoir_ctx*) ctx;
+    size_t index = c->seen;
+    c->seen += 1;
+
+    if (index < c->k) {
+        memcpy(c->out + index * c->element_size, element, c->element_size);
+        if (c->seen == c->k) {
+            c->next = index;
+            _reservoir_schedule(c);
+        }
+
+        return true;
+    }
+
+    if (index == c->next) {
+        size_t slot = _random_next(&c->rng) % c->k;
+        memcpy(c->out + slot * c->element_size, element, c->element_size);
+        _reservoir_schedule(c);
+    }
+
+    return true;
+}
+
+// Copies a uniform sample of up to k elements into out, which must have
+// room for k elements of element_size bytes. Returns the sample size.
+size_t stream_reservoir(struct stream* stream, void* out, size_t k, size_t element_size) {
+    if (k == 0) {
+        stream_cleanup(stream);
+        return 0;
+    }
+
+    struct reservoir_ctx ctx = {
+        .out = out,
+        .k = k,
+        .element_size = element_size,
+        .w = 1.0,
+        .rng = _random_seed(),
+    };
+
+    stream_consume(stream, _reservoir_consumer, &ctx);
+    return ctx.seen < k ? ctx.seen : k;
+}
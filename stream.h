@@ -1,6 +1,8 @@
 #pragma once
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef void(*map_handler)(void* dst, void* element);
 typedef bool(*filter_handler)(void* element);
@@ -9,8 +11,145 @@ typedef void(*foreach_handler)(void* element);
 
 typedef void* (*next_handler)(void* state);
 typedef void (*increment_state_handler)(void* state);
+// Asked once the source returns NULL, to tell a clean end from a failure
+typedef int (*status_handler)(void* state);
+// Optional: skips up to count elements without producing them and returns
+// how many were skipped
+typedef size_t (*advance_handler)(void* state, size_t count);
 
 typedef bool (*match_predicate)(void* element);
+typedef size_t (*partition_handler)(void* element);
+typedef uint64_t (*hash_handler)(void* element);
+typedef double (*value_handler)(void* element);
+// Writes element into buffer and returns its length, like snprintf. When
+// that is capacity or more, the element is formatted again with more room.
+typedef size_t (*format_handler)(void* element, char* buffer, size_t capacity);
+
+// Per-stream status. The first error wins; terminals stop at the next
+// check and the status stays readable after the stream is consumed.
+enum stream_status {
+    STREAM_OK = 0,
+    STREAM_ERR_NOMEM,
+    STREAM_ERR_SOURCE,
+    STREAM_ERR_IO,
+    STREAM_CANCELLED,
+};
+
+// The status and cancel flag are polled once per this many elements
+#ifndef STREAM_CHECK_INTERVAL
+#define STREAM_CHECK_INTERVAL 64
+#endif
+
+enum stream_partition_mode {
+    // scatter through per-partition write-combining buffers
+    STREAM_PARTITION_SCATTER,
+    // stage everything, count a histogram, then place each element exactly
+    STREAM_PARTITION_HISTOGRAM,
+};
+
+struct stream_partition {
+    void* data;
+    size_t length;
+    size_t capacity;
+};
+
+struct stream_partitions {
+    size_t count;
+    size_t element_size;
+    struct stream_partition* partitions;
+    void* storage;
+};
+
+// Approximate aggregation sketches.
+// HLL, Count-Min and Bloom use memory fixed at init time; the KLL sketch
+// grows its levels during adds but stays bounded at roughly O(k + log n).
+// Each can be merged with another sketch built with the same parameters,
+// e.g. one per partition or per worker.
+// Element hashes are remixed internally, so a plain hash is enough.
+struct hll_sketch {
+    unsigned precision;
+    uint8_t* registers;
+    hash_handler hash;
+};
+
+struct count_min_sketch {
+    size_t width;
+    size_t depth;
+    uint64_t* counters;
+    hash_handler hash;
+};
+
+#define KLL_MAX_LEVELS 64
+
+// Quantile sketch over the values returned by value_handler.
+// Level capacities start at k for the top level and shrink by 2/3 per level
+// below it (never under 2), so they add up to less than 3k plus 2 per level.
+// A level is compacted as soon as it fills, so in practice the sketch holds
+// about k to 2.5k values (240-490 for k = 200). Rank error shrinks as k grows.
+struct kll_sketch {
+    size_t k;
+    value_handler value;
+    uint64_t n;
+    uint64_t rng;
+
+    size_t levels;
+    double* items[KLL_MAX_LEVELS];
+    size_t lengths[KLL_MAX_LEVELS];
+    size_t capacities[KLL_MAX_LEVELS];
+    size_t limits[KLL_MAX_LEVELS];
+};
+
+struct bloom_filter {
+    size_t bits;
+    unsigned hashes;
+    uint64_t* words;
+    hash_handler hash;
+};
+
+uint64_t stream_hash_bytes(const void* data, size_t length);
+
+bool hll_sketch_init(struct hll_sketch* sketch, unsigned precision, hash_handler hash);
+void hll_sketch_add(struct hll_sketch* sketch, void* element);
+double hll_sketch_estimate(const struct hll_sketch* sketch);
+bool hll_sketch_merge(struct hll_sketch* dst, const struct hll_sketch* src);
+void hll_sketch_destroy(struct hll_sketch* sketch);
+
+bool count_min_sketch_init(struct count_min_sketch* sketch, size_t width, size_t depth, hash_handler hash);
+void count_min_sketch_add(struct count_min_sketch* sketch, void* element, uint64_t count);
+uint64_t count_min_sketch_estimate(const struct count_min_sketch* sketch, void* element);
+bool count_min_sketch_merge(struct count_min_sketch* dst, const struct count_min_sketch* src);
+void count_min_sketch_destroy(struct count_min_sketch* sketch);
+
+bool kll_sketch_init(struct kll_sketch* sketch, size_t k, value_handler value);
+bool kll_sketch_add(struct kll_sketch* sketch, double value);
+double kll_sketch_quantile(const struct kll_sketch* sketch, double q);
+bool kll_sketch_merge(struct kll_sketch* dst, const struct kll_sketch* src);
+void kll_sketch_destroy(struct kll_sketch* sketch);
+
+bool bloom_filter_init(struct bloom_filter* filter, size_t bits, unsigned hashes, hash_handler hash);
+void bloom_filter_add(struct bloom_filter* filter, void* element);
+bool bloom_filter_contains(const struct bloom_filter* filter, void* element);
+bool bloom_filter_merge(struct bloom_filter* dst, const struct bloom_filter* src);
+void bloom_filter_destroy(struct bloom_filter* filter);
+
+// Output buffers of stream_to_fd; a full set is flushed with one writev.
+// Building with -DSTREAM_IO_URING uses two sets and writes one through
+// io_uring while the other is being filled.
+#ifndef STREAM_FD_BUFFER_SIZE
+#define STREAM_FD_BUFFER_SIZE (64 * 1024)
+#endif
+#define STREAM_FD_BUFFERS 4
+
+// Receives each element that made it through the pipeline.
+// Returning false stops the stream.
+typedef bool (*stream_consumer)(void* element, void* ctx);
+
+// Source characteristics, similar to Java's Spliterator flags.
+// They describe the source as a whole and are updated by each intermediate
+// operation, so terminals can skip work that the flags make redundant.
+enum stream_characteristics {
+    STREAM_SIZED = 1 << 0, // the exact element count is known
+};
 
 struct vector_op {
     size_t length;
@@ -22,6 +161,20 @@ struct stream{
     void* state;
     next_handler next;
     increment_state_handler increment_state;
+    status_handler source_status;
+    advance_handler advance;
+
+    _Atomic int status;
+
+    unsigned characteristics;
+    size_t size;
+
+    // push and pull mode
+    stream_consumer sink;
+    void* sink_ctx;
+    bool stopped;
+    bool released;
+    bool pull_pending;
 
     struct vector_op ops;
 };
@@ -33,12 +186,23 @@ struct stream_op {
 };
 
 struct stream stream_init(void* state, next_handler next, increment_state_handler increment_state);
+struct stream stream_init_sized(void* state, next_handler next, increment_state_handler increment_state,
+        unsigned characteristics, size_t size);
+bool stream_exact_size(struct stream* stream, size_t* size);
+struct stream stream_init_push(stream_consumer consumer, void* ctx);
+void stream_set_status_handler(struct stream* stream, status_handler handler);
+void stream_set_advance_handler(struct stream* stream, advance_handler handler);
+
+int stream_get_status(struct stream* stream);
+void stream_fail(struct stream* stream, int status);
+void stream_cancel(struct stream* stream);
 void stream_cleanup(struct stream* stream);
 
 void stream_map(struct stream* stream, map_handler handler, size_t output_element_size);
 void stream_filter(struct stream* stream, filter_handler handler);
 void stream_peek(struct stream* stream, void (*peek_handler)(void* element));
 void stream_limit(struct stream* stream, size_t max_length);
+void stream_sample(struct stream* stream, double probability);
 
 void stream_for_each(struct stream* stream, foreach_handler handler);
 void* stream_to_collection(struct stream* stream, void* (*init)(),
@@ -46,3 +210,86 @@ void* stream_to_collection(struct stream* stream, void* (*init)(),
 size_t stream_count(struct stream* stream);
 bool stream_any_match(struct stream* stream, match_predicate matcher);
 bool stream_all_match(struct stream* stream, match_predicate matcher);
+bool stream_partition(struct stream* stream, struct stream_partitions* out, size_t count,
+        size_t element_size, partition_handler key, enum stream_partition_mode mode);
+void stream_partitions_destroy(struct stream_partitions* partitions);
+
+void stream_to_hll(struct stream* stream, struct hll_sketch* sketch);
+void stream_to_count_min(struct stream* stream, struct count_min_sketch* sketch);
+void stream_to_kll(struct stream* stream, struct kll_sketch* sketch);
+void stream_to_bloom(struct stream* stream, struct bloom_filter* filter);
+void stream_bloom_filter(struct stream* stream, struct bloom_filter* filter);
+size_t stream_to_fd(struct stream* stream, int fd, format_handler format);
+size_t stream_reservoir(struct stream* stream, void* out, size_t k, size_t element_size);
+
+void stream_consume(struct stream* stream, stream_consumer consumer, void* ctx);
+bool stream_push(struct stream* stream, void* element);
+size_t stream_push_batch(struct stream* stream, void* elements, size_t count, size_t element_size);
+void stream_finish(struct stream* stream);
+void* stream_next(struct stream* stream);
+void stream_tee(struct stream* stream, struct stream* branches, size_t count);
+
+// Delta/varint encoded integer source.
+// A blob is a uint64 total count followed by blocks of up to
+// STREAM_VARINT_BLOCK sorted values: a header { uint32 count, uint32 payload
+// bytes, uint64 first value } and count - 1 LEB128 varint deltas. Blocks are
+// decoded one at a time, so the whole list is never materialized.
+#define STREAM_VARINT_BLOCK 128
+
+struct varint_source {
+    const uint8_t* data;
+    size_t length;
+    size_t offset;
+    size_t remaining;
+    bool validated;
+
+    uint64_t block[STREAM_VARINT_BLOCK];
+    size_t block_length;
+    size_t index;
+};
+
+size_t stream_varint_encode(const uint64_t* values, size_t count, uint8_t** out);
+void varint_source_init(struct varint_source* source, const uint8_t* data, size_t length);
+bool varint_source_validate(struct varint_source* source);
+void* varint_source_next(void* state);
+void varint_source_increment(void* state);
+bool varint_source_skip_to(struct varint_source* source, uint64_t target);
+int varint_source_status(void* state);
+size_t varint_source_advance(void* state, size_t count);
+struct stream stream_from_varint(struct varint_source* source);
+
+// Generator source.
+// The producer runs on its own pooled stack and hands elements to the
+// pipeline with stream_yield, so traversals keep their natural control flow.
+// A yielded pointer stays valid until the producer is resumed, and the
+// generator must not be moved after stream_generator_init.
+// Producers get STREAM_GENERATOR_STACK_SIZE bytes of stack; deep recursion
+// (e.g. walking a degenerate tree) needs a larger value. Overflowing it hits
+// a guard page and crashes rather than corrupting memory.
+#ifndef STREAM_GENERATOR_STACK_SIZE
+#define STREAM_GENERATOR_STACK_SIZE (64 * 1024)
+#endif
+
+struct stream_generator;
+typedef void (*generator_handler)(struct stream_generator* generator, void* ctx);
+
+struct stream_generator {
+    generator_handler producer;
+    void* ctx;
+
+    void* current;
+    bool has_current;
+    bool done;
+
+    void* stack;
+    void* caller_sp;
+    void* generator_sp;
+    void* contexts;
+};
+
+bool stream_generator_init(struct stream_generator* generator, generator_handler producer, void* ctx);
+void stream_generator_destroy(struct stream_generator* generator);
+void stream_yield(struct stream_generator* generator, void* element);
+void* stream_generator_next(void* state);
+void stream_generator_increment(void* state);
+struct stream stream_from_generator(struct stream_generator* generator);